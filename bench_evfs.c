@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+
+struct ext4_evfs_batch {
+    uint64_t eb_blocks;
+    uint64_t eb_status;
+    uint64_t eb_prior;
+    uint32_t eb_count;
+    uint32_t eb_flags;
+};
+struct ext4_evfs_query {
+    uint64_t eq_start;
+    uint64_t eq_len;
+    uint64_t eq_bits;
+    uint32_t eq_flags;
+    uint32_t eq_pad;
+};
+#define EXT4_IOC_FLIP_BLOCK_BIT  _IOW('f', 100, uint64_t)
+#define EXT4_IOC_FLIP_BLOCK_BITS _IOW('f', 101, struct ext4_evfs_batch)
+#define EXT4_IOC_GET_BLOCK_BITS  _IOW('f', 104, struct ext4_evfs_query)
+
+#define SANDBOX   "/home/evie/code/evfs-sandbox"
+#define QUERY_MAX (1ULL << 27)      // EXT4_EVFS_MAX_BITS
+#define MAX_LIST  16
+
+enum locality { SAME, RANDOM, SEQ };
+static const char *locality_names[] = { "same", "random", "seq" };
+
+static int fd;
+static uint64_t *free_blocks;       // every free block, ascending
+static uint64_t nr_free;
+static uint64_t per_group = 32768;
+static long iters = 20000;          // syscalls per thread, kept even
+static unsigned pool_size = 4096;   // blocks each thread cycles through
+
+struct worker {
+    pthread_t tid;
+    uint64_t *pool;
+    unsigned pool_len;
+    unsigned batch;
+    uint64_t *lat;                  // ns per syscall
+    pthread_barrier_t *start_line;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Find every free block with EXT4_IOC_GET_BLOCK_BITS */
+static int load_free_blocks(void) {
+    struct statfs st;
+    if (statfs(SANDBOX, &st) < 0) { perror("statfs"); return -1; }
+
+    uint64_t total = st.f_blocks;
+    uint8_t *bits = malloc(QUERY_MAX / 8);
+    free_blocks = malloc(st.f_bfree * sizeof(*free_blocks));
+    if (!bits || !free_blocks) { perror("malloc"); return -1; }
+
+    // block 0 is never free, and is invalid with 1k blocks
+    for (uint64_t start = 1; start < total; start += QUERY_MAX) {
+        uint64_t len = total - start < QUERY_MAX ? total - start : QUERY_MAX;
+        struct ext4_evfs_query query = {
+            .eq_start = start,
+            .eq_len = len,
+            .eq_bits = (uintptr_t)bits,
+        };
+        if (ioctl(fd, EXT4_IOC_GET_BLOCK_BITS, &query) < 0) {
+            perror("ioctl GET_BLOCK_BITS");
+            return -1;
+        }
+        for (uint64_t i = 0; i < len && nr_free < st.f_bfree; i++)
+            if (!(bits[i / 8] & (1 << (i % 8))))
+                free_blocks[nr_free++] = start + i;
+    }
+    free(bits);
+    return 0;
+}
+
+/*
+ * Give each of nthreads workers its pool of free blocks:
+ * same   - all from the group with the most free blocks, interleaved
+ * seq    - consecutive free blocks, one stretch per thread
+ * random - drawn from anywhere on the filesystem
+ */
+static int make_pools(struct worker *w, int nthreads, enum locality loc) {
+    uint64_t need = (uint64_t)nthreads * pool_size;
+    uint64_t *src = free_blocks, nr = nr_free;
+    uint64_t *shuffled = NULL;
+
+    if (loc == SAME) {
+        uint64_t best = 0, best_len = 0;
+        for (uint64_t i = 0, j; i < nr_free; i = j) {
+            for (j = i; j < nr_free &&
+                 free_blocks[j] / per_group == free_blocks[i] / per_group; j++)
+                ;
+            if (j - i > best_len) { best = i; best_len = j - i; }
+        }
+        src = free_blocks + best;
+        nr = best_len;
+    } else if (loc == RANDOM) {
+        shuffled = malloc(nr_free * sizeof(*shuffled));
+        if (!shuffled) { perror("malloc"); return -1; }
+        memcpy(shuffled, free_blocks, nr_free * sizeof(*shuffled));
+        srand48(1);     // the same draw every run
+        for (uint64_t i = 0; i < need && i < nr_free; i++) {
+            uint64_t k = i + lrand48() % (nr_free - i);
+            uint64_t tmp = shuffled[i];
+            shuffled[i] = shuffled[k];
+            shuffled[k] = tmp;
+        }
+        src = shuffled;
+    }
+
+    unsigned len = nr / nthreads < pool_size ? nr / nthreads : pool_size;
+    if (len < w[0].batch) {
+        fprintf(stderr, "%s: only %lu free blocks for %d threads\n",
+                locality_names[loc], nr, nthreads);
+        free(shuffled);
+        return -1;
+    }
+    for (int t = 0; t < nthreads; t++) {
+        w[t].pool_len = len;
+        for (unsigned i = 0; i < len; i++)
+            w[t].pool[i] = loc == SAME ? src[(uint64_t)i * nthreads + t]
+                                       : src[(uint64_t)t * len + i];
+    }
+    free(shuffled);
+    return 0;
+}
+
+/*
+ * Syscall 2k flips a batch of the pool and syscall 2k + 1 flips it back,
+ * so the filesystem ends as it started. Successive pairs walk the pool.
+ */
+static void *worker_fn(void *arg) {
+    struct worker *w = arg;
+    unsigned batches = w->pool_len / w->batch;
+
+    pthread_barrier_wait(w->start_line);
+    for (long i = 0; i < iters; i++) {
+        uint64_t *blocks = &w->pool[(i / 2 % batches) * w->batch];
+        uint64_t t0 = now_ns();
+        int ret;
+
+        if (w->batch == 1) {
+            ret = ioctl(fd, EXT4_IOC_FLIP_BLOCK_BIT, blocks);
+        } else {
+            struct ext4_evfs_batch batch = {
+                .eb_blocks = (uintptr_t)blocks,
+                .eb_count = w->batch,
+            };
+            ret = ioctl(fd, EXT4_IOC_FLIP_BLOCK_BITS, &batch);
+        }
+        if (ret < 0) {
+            perror("ioctl flip");
+            exit(1);
+        }
+        w->lat[i] = now_ns() - t0;
+    }
+    return NULL;
+}
+
+static int drop_caches(void) {
+    sync();
+    int dc = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (dc < 0 || write(dc, "3", 1) != 1) {
+        perror("drop_caches (cold runs need root)");
+        return -1;
+    }
+    close(dc);
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct_us(uint64_t *sorted, uint64_t n, double p) {
+    uint64_t i = (uint64_t)(p * (n - 1));
+    return sorted[i] / 1e3;
+}
+
+static int run(struct worker *w, int nthreads, unsigned batch,
+               enum locality loc, int cold) {
+    pthread_barrier_t start_line;
+    uint64_t n = (uint64_t)nthreads * iters;
+    uint64_t *all = malloc(n * sizeof(*all));
+    if (!all) { perror("malloc"); return -1; }
+
+    for (int t = 0; t < nthreads; t++) {
+        w[t].batch = batch;
+        w[t].start_line = &start_line;
+    }
+    if (make_pools(w, nthreads, loc) || (cold && drop_caches())) {
+        free(all);
+        return -1;
+    }
+
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; t++)
+        pthread_create(&w[t].tid, NULL, worker_fn, &w[t]);
+    pthread_barrier_wait(&start_line);
+    uint64_t t0 = now_ns();
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(w[t].tid, NULL);
+    double secs = (now_ns() - t0) / 1e9;
+    pthread_barrier_destroy(&start_line);
+
+    for (int t = 0; t < nthreads; t++)
+        memcpy(all + (uint64_t)t * iters, w[t].lat, iters * sizeof(*all));
+    qsort(all, n, sizeof(*all), cmp_u64);
+    printf("%d,%u,%s,%s,%lu,%.3f,%.0f,%.1f,%.1f,%.1f\n",
+           nthreads, batch, locality_names[loc], cold ? "cold" : "warm",
+           n * batch, secs, n * batch / secs,
+           pct_us(all, n, 0.5), pct_us(all, n, 0.99), pct_us(all, n, 0.999));
+    fflush(stdout);
+    free(all);
+    return 0;
+}
+
+/* Parse "1,2,4" into list, returning how many there were */
+static int parse_list(char *arg, int *list) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST;
+         tok = strtok(NULL, ","))
+        list[n++] = atoi(tok);
+    return n;
+}
+
+static int parse_locality(char *arg, int *list) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST;
+         tok = strtok(NULL, ",")) {
+        int l;
+        for (l = 0; l < 3 && strcmp(tok, locality_names[l]); l++)
+            ;
+        if (l == 3) {
+            fprintf(stderr, "unknown locality %s\n", tok);
+            exit(1);
+        }
+        list[n++] = l;
+    }
+    return n;
+}
+
+/*
+ * usage: bench_evfs [-t threads] [-b batch] [-l same,random,seq]
+ *                   [-c warm,cold] [-n syscalls] [-p pool] [-g per_group]
+ * Runs every combination of the comma-separated lists against the loop
+ * mounted sandbox (remount-evfs-sandbox.sh) and prints one CSV row per
+ * run: bits flipped per second and p50/p99/p999 latency of a syscall in
+ * microseconds. Each thread cycles through its own pool of free blocks,
+ * flipping every batch and then flipping it back, so the image ends as
+ * it started. Cold runs drop the page cache first and must run as root.
+ * Build with -pthread.
+ */
+int main(int argc, char **argv) {
+    int threads[MAX_LIST] = { 1, 2, 4, 8 }, nr_threads = 4;
+    int batches[MAX_LIST] = { 1, 16, 256 }, nr_batches = 3;
+    int locs[MAX_LIST] = { SAME, RANDOM, SEQ }, nr_locs = 3;
+    int colds[MAX_LIST] = { 0 }, nr_colds = 1;
+    int opt, max_threads = 0, max_batch = 0;
+
+    while ((opt = getopt(argc, argv, "t:b:l:c:n:p:g:")) != -1) {
+        switch (opt) {
+        case 't': nr_threads = parse_list(optarg, threads); break;
+        case 'b': nr_batches = parse_list(optarg, batches); break;
+        case 'l': nr_locs = parse_locality(optarg, locs); break;
+        case 'c':
+            nr_colds = 0;
+            for (char *tok = strtok(optarg, ","); tok && nr_colds < MAX_LIST;
+                 tok = strtok(NULL, ","))
+                colds[nr_colds++] = !strcmp(tok, "cold");
+            break;
+        case 'n': iters = atol(optarg); break;
+        case 'p': pool_size = atoi(optarg); break;
+        case 'g': per_group = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "see the comment above main() for usage\n");
+            return 1;
+        }
+    }
+    iters += iters & 1;
+    for (int i = 0; i < nr_threads; i++)
+        if (threads[i] > max_threads) max_threads = threads[i];
+    for (int i = 0; i < nr_batches; i++)
+        if (batches[i] > max_batch) max_batch = batches[i];
+    if (max_threads < 1 || max_batch < 1 || iters < 2 ||
+        pool_size < (unsigned)max_batch) {
+        fprintf(stderr, "threads, batch and syscalls must be positive, "
+                "and the pool at least one batch\n");
+        return 1;
+    }
+
+    fd = open(SANDBOX "/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+    if (load_free_blocks())
+        return 1;
+
+    struct worker *w = calloc(max_threads, sizeof(*w));
+    if (!w) { perror("calloc"); return 1; }
+    for (int t = 0; t < max_threads; t++) {
+        w[t].pool = malloc(pool_size * sizeof(*w[t].pool));
+        w[t].lat = malloc(iters * sizeof(*w[t].lat));
+        if (!w[t].pool || !w[t].lat) { perror("malloc"); return 1; }
+    }
+
+    printf("threads,batch,locality,cache,bits,secs,bits_per_sec,"
+           "p50_us,p99_us,p999_us\n");
+    for (int c = 0; c < nr_colds; c++)
+        for (int l = 0; l < nr_locs; l++)
+            for (int b = 0; b < nr_batches; b++)
+                for (int t = 0; t < nr_threads; t++)
+                    if (run(w, threads[t], batches[b], locs[l], colds[c]))
+                        return 1;
+
+    close(fd);
+    return 0;
+}
@@ -1,2 +1,2 @@
-sudo umount /home/evie/code/evfs-sandbox 
-sudo debugfs -R "testb 1000" /home/evie/code/evfs-sandbox.img
\ No newline at end of file
+# EXT4_IOC_GET_BLOCK_BITS reads the live bitmap, no unmount/debugfs needed
+./test_get_bits 1000
@@ -0,0 +1,654 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests and microbenchmarks for EVFS. Like mballoc-test.c this is
+ * built into its subject (ext4-evfs.o) so the static helpers are in
+ * reach. Each test formats a one-group filesystem in memory: a bare
+ * super block with crc32c and metadata_csum, a flex group, and the
+ * group's descriptor and block bitmap in kmalloc()ed buffers with no
+ * device, journal or buddy behind them. Operations on it end with the
+ * real ext4_evfs_group_end(), so the tests see the counters and
+ * checksums it computes.
+ *
+ *   ./tools/testing/kunit/kunit.py run --kunitconfig=fs/ext4 'ext4_evfs*'
+ *
+ * The benchmarks are marked slow; add --filter speed!=slow to skip them.
+ */
+
+#include <kunit/test.h>
+#include <crypto/hash.h>
+#include <linux/prandom.h>
+
+#define EVFS_TEST_BLOCKSIZE_BITS	12
+#define EVFS_TEST_BLOCKSIZE		(1 << EVFS_TEST_BLOCKSIZE_BITS)
+#define EVFS_TEST_CLUSTERS		(EVFS_TEST_BLOCKSIZE * 8)
+/* Leading clusters in use from the start, as group metadata would be */
+#define EVFS_TEST_META			1024
+/* Seeds the bitmaps and checksums; fixed, so a failure replays */
+#define EVFS_TEST_SEED			0x45564653
+
+struct evfs_test_fs {
+	struct super_block	sb;
+	struct ext4_sb_info	sbi;
+	struct ext4_super_block	es;
+	struct ext4_evfs_info	ei;
+	struct blockgroup_lock	bgl;
+	struct flex_groups	flex;
+	struct flex_groups	*flex_groups[1];
+	struct ext4_group_desc	*gdp;
+	struct buffer_head	*gdp_bh;
+	void			*bitmap;
+	struct buffer_head	*bitmap_bh;
+	void			*orig;	/* bitmap as formatted */
+	void			*claimed; /* scratch: bitmap & ~orig */
+	void			*mb;	/* mballoc's bitmap, if any */
+	struct ext4_evfs_track	*track;
+	struct ext4_evfs_group	eg;	/* as the last operation left it */
+	s64			free;	/* free clusters as formatted */
+	s64			dirty;	/* s_dirtyclusters_counter between ops */
+	bool			counters; /* sbi counters initialised */
+	struct rnd_state	rnd;
+};
+
+static struct buffer_head *evfs_test_bh(void *data)
+{
+	struct buffer_head *bh = alloc_buffer_head(GFP_KERNEL);
+
+	if (!bh)
+		return NULL;
+	bh->b_data = data;
+	bh->b_size = EVFS_TEST_BLOCKSIZE;
+	/*
+	 * Already dirty, so that ext4_handle_dirty_metadata() without a
+	 * journal has no page to mark behind it.
+	 */
+	set_buffer_uptodate(bh);
+	set_buffer_dirty(bh);
+	return bh;
+}
+
+static int evfs_test_init(struct kunit *test)
+{
+	struct evfs_test_fs *fs;
+	struct ext4_sb_info *sbi;
+	int i;
+
+	fs = kunit_kzalloc(test, sizeof(*fs), GFP_KERNEL);
+	if (!fs)
+		return -ENOMEM;
+	test->priv = fs;
+	sbi = &fs->sbi;
+	fs->sb.s_fs_info = sbi;
+	fs->sb.s_blocksize = EVFS_TEST_BLOCKSIZE;
+	fs->sb.s_blocksize_bits = EVFS_TEST_BLOCKSIZE_BITS;
+	sbi->s_sb = &fs->sb;
+	sbi->s_es = &fs->es;
+	sbi->s_blocks_per_group = EVFS_TEST_CLUSTERS;
+	sbi->s_clusters_per_group = EVFS_TEST_CLUSTERS;
+	sbi->s_desc_size = EXT4_MIN_DESC_SIZE_64BIT;
+	sbi->s_chksum_driver = crypto_alloc_shash("crc32c", 0, 0);
+	if (IS_ERR(sbi->s_chksum_driver))
+		return PTR_ERR(sbi->s_chksum_driver);
+	ext4_set_feature_metadata_csum(&fs->sb);
+	sbi->s_csum_seed = EVFS_TEST_SEED;
+	prandom_seed_state(&fs->rnd, EVFS_TEST_SEED);
+
+	// the group is the first of a flex group that has only it
+	bgl_lock_init(&fs->bgl);
+	sbi->s_blockgroup_lock = &fs->bgl;
+	sbi->s_log_groups_per_flex = 4;
+	fs->flex_groups[0] = &fs->flex;
+	RCU_INIT_POINTER(sbi->s_flex_groups, fs->flex_groups);
+	sbi->s_flex_groups_allocated = 1;
+	fs->ei.ei_sb = &fs->sb;
+	fs->ei.ei_stats = alloc_percpu(struct ext4_evfs_stats);
+
+	fs->gdp = kunit_kzalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	fs->bitmap = kunit_kzalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	fs->orig = kunit_kzalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	fs->claimed = kunit_kzalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	fs->track = kzalloc(sizeof(*fs->track), GFP_KERNEL);
+	if (!fs->ei.ei_stats || !fs->gdp || !fs->bitmap || !fs->orig ||
+	    !fs->claimed || !fs->track)
+		return -ENOMEM;
+	fs->gdp_bh = evfs_test_bh(fs->gdp);
+	fs->bitmap_bh = evfs_test_bh(fs->bitmap);
+	if (!fs->gdp_bh || !fs->bitmap_bh)
+		return -ENOMEM;
+
+	// metadata up front, then a sprinkling of blocks owned by files
+	mb_set_bits(fs->bitmap, 0, EVFS_TEST_META);
+	for (i = 0; i < 256; i++)
+		ext4_set_bit(EVFS_TEST_META +
+			     prandom_u32_state(&fs->rnd) %
+			     (EVFS_TEST_CLUSTERS - EVFS_TEST_META), fs->bitmap);
+	memcpy(fs->orig, fs->bitmap, EVFS_TEST_BLOCKSIZE);
+
+	// set bits are claimed against these, as for an allocation
+	fs->free = EVFS_TEST_CLUSTERS - bitmap_weight(fs->bitmap,
+						      EVFS_TEST_CLUSTERS);
+	ext4_free_group_clusters_set(&fs->sb, fs->gdp, fs->free);
+	ext4_block_bitmap_csum_set(&fs->sb, fs->gdp, fs->bitmap_bh);
+	ext4_group_desc_csum_set(&fs->sb, 0, fs->gdp);
+	atomic64_set(&fs->flex.free_clusters, fs->free);
+	if (percpu_counter_init(&sbi->s_freeclusters_counter, fs->free,
+				GFP_KERNEL))
+		return -ENOMEM;
+	if (percpu_counter_init(&sbi->s_dirtyclusters_counter, 0,
+				GFP_KERNEL)) {
+		percpu_counter_destroy(&sbi->s_freeclusters_counter);
+		return -ENOMEM;
+	}
+	fs->counters = true;
+	return 0;
+}
+
+static void evfs_test_exit(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+
+	if (!fs)
+		return;
+	if (!IS_ERR_OR_NULL(fs->sbi.s_chksum_driver))
+		crypto_free_shash(fs->sbi.s_chksum_driver);
+	if (fs->counters) {
+		percpu_counter_destroy(&fs->sbi.s_dirtyclusters_counter);
+		percpu_counter_destroy(&fs->sbi.s_freeclusters_counter);
+	}
+	ext4_evfs_track_free(fs->track);
+	if (fs->bitmap_bh)
+		free_buffer_head(fs->bitmap_bh);
+	if (fs->gdp_bh)
+		free_buffer_head(fs->gdp_bh);
+	free_percpu(fs->ei.ei_stats);
+}
+
+/*
+ * Run @req on the group as ext4_evfs_run() does without rq_status, from
+ * what ext4_evfs_group_begin() leaves through ext4_evfs_group_end() and
+ * the flex group update; only the bitmap read and the journal are left
+ * out. Returns the last entry's state, or the first error.
+ */
+static int evfs_test_run(struct evfs_test_fs *fs, struct ext4_evfs_req *req)
+{
+	struct ext4_evfs_group *eg = &fs->eg;
+	struct ext4_evfs_flex ef = { 0 };
+	int state = 0, err;
+	u32 i;
+
+	memset(eg, 0, sizeof(*eg));
+	eg->eg_track = fs->track;
+	// as ext4_evfs_track_prepare() would if the runs could overflow
+	eg->eg_track_spare = kmalloc(EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	if (!eg->eg_track_spare)
+		return -ENOMEM;
+	eg->eg_bitmap_bh = get_bh(fs->bitmap_bh);
+	eg->eg_gdp = fs->gdp;
+	eg->eg_gdp_bh = fs->gdp_bh;
+	eg->eg_buddy.bd_bitmap = fs->mb;
+	ext4_lock_group(&fs->sb, eg->eg_group);
+
+	for (i = 0; i < req->rq_count; i++) {
+		state = ext4_evfs_apply(&fs->sb, req, eg, &req->rq_ents[i]);
+		if (state < 0)
+			break;
+	}
+	err = ext4_evfs_group_end(NULL, &fs->sb, &fs->ei, eg);
+	req->rq_changed = eg->eg_changed;
+	ext4_evfs_flex_add(&fs->sb, &ef, eg->eg_group, eg->eg_free_delta);
+	ext4_evfs_flex_flush(&fs->sb, &ef);
+	return err ?: state;
+}
+
+static int evfs_test_apply(struct evfs_test_fs *fs, int mode,
+			   ext4_grpblk_t offset, ext4_grpblk_t len)
+{
+	struct ext4_evfs_entry ent = {
+		.ee_block = offset,
+		.ee_offset = offset,
+		.ee_len = len,
+	};
+	struct ext4_evfs_req req = {
+		.rq_mode = mode,
+		.rq_ents = &ent,
+		.rq_count = 1,
+	};
+
+	return evfs_test_run(fs, &req);
+}
+
+static int evfs_test_weight(void *bm)
+{
+	return bitmap_weight(bm, EVFS_TEST_CLUSTERS);
+}
+
+/* Set bits of @bm in [start, end), in ext4's bit order */
+static int evfs_test_count(void *bm, int start, int end)
+{
+	int n = 0;
+
+	for (; start < end; start++)
+		n += !!ext4_test_bit(start, bm);
+	return n;
+}
+
+/* Would clearing [start, start + len) free a block EVFS didn't claim? */
+static bool evfs_test_unclaimed(struct evfs_test_fs *fs, int start, int len)
+{
+	return ext4_find_next_bit(fs->orig, start + len, start) < start + len;
+}
+
+static ext4_grpblk_t evfs_test_random_free(struct evfs_test_fs *fs)
+{
+	ext4_grpblk_t bit;
+
+	do {
+		bit = prandom_u32_state(&fs->rnd) % EVFS_TEST_CLUSTERS;
+	} while (ext4_test_bit(bit, fs->bitmap));
+	return bit;
+}
+
+/*
+ * The free counts group_end and the flex update left in the descriptor,
+ * the superblock counter and the flex group, the claims, and the bitmap
+ * and descriptor checksums must all agree with the bitmap as it now is.
+ */
+static void evfs_test_check_coherent(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	s64 free = EVFS_TEST_CLUSTERS - evfs_test_weight(fs->bitmap);
+
+	KUNIT_EXPECT_EQ(test, ext4_free_group_clusters(&fs->sb, fs->gdp),
+			free);
+	KUNIT_EXPECT_EQ(test, percpu_counter_sum(
+			&fs->sbi.s_freeclusters_counter), free);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&fs->flex.free_clusters), free);
+	// a claim ends with the operation that made it
+	KUNIT_EXPECT_EQ(test, percpu_counter_sum(
+			&fs->sbi.s_dirtyclusters_counter), fs->dirty);
+
+	bitmap_andnot(fs->claimed, fs->bitmap, fs->orig, EVFS_TEST_CLUSTERS);
+	KUNIT_EXPECT_EQ(test, fs->track->et_count,
+			evfs_test_weight(fs->claimed));
+	KUNIT_EXPECT_TRUE(test, ext4_evfs_track_covers(fs->track,
+			fs->claimed, 0, EVFS_TEST_CLUSTERS));
+
+	KUNIT_EXPECT_TRUE(test, ext4_block_bitmap_csum_verify(&fs->sb, fs->gdp,
+							      fs->bitmap_bh));
+	KUNIT_EXPECT_TRUE(test, ext4_group_desc_csum_verify(&fs->sb, 0,
+							    fs->gdp));
+}
+
+static void test_flip(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	ext4_grpblk_t bit = evfs_test_random_free(fs);
+
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_FLIP, bit, 1), 1);
+	KUNIT_EXPECT_TRUE(test, ext4_test_bit(bit, fs->bitmap));
+	KUNIT_EXPECT_EQ(test, fs->eg.eg_changed, 1);
+	evfs_test_check_coherent(test);
+
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_FLIP, bit, 1), 0);
+	KUNIT_EXPECT_FALSE(test, ext4_test_bit(bit, fs->bitmap));
+	KUNIT_EXPECT_EQ(test, fs->eg.eg_changed, 1);
+	KUNIT_EXPECT_EQ(test, ext4_free_group_clusters(&fs->sb, fs->gdp),
+			fs->free);
+	evfs_test_check_coherent(test);
+}
+
+/* Blocks EVFS didn't claim are never freed, and nothing changes trying */
+static void test_unclaimed(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_FLIP, 10, 1),
+			-EPERM);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_CLEAR,
+			EVFS_TEST_META - 8, 64), -EPERM);
+	KUNIT_EXPECT_EQ(test, memcmp(fs->bitmap, fs->orig, EVFS_TEST_BLOCKSIZE),
+			0);
+	KUNIT_EXPECT_EQ(test, fs->eg.eg_changed, 0);
+	evfs_test_check_coherent(test);
+
+	// once claimed around the used blocks, clearing still stops at them
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_SET,
+			EVFS_TEST_META, 4096), 1);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_CLEAR,
+			EVFS_TEST_META, 4096),
+			evfs_test_unclaimed(fs, EVFS_TEST_META, 4096) ?
+			-EPERM : 0);
+	evfs_test_check_coherent(test);
+}
+
+/* Space promised to delayed allocation can't be set out from under it */
+static void test_enospc(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	ext4_grpblk_t bit = evfs_test_random_free(fs);
+
+	fs->dirty = fs->free;
+	percpu_counter_set(&fs->sbi.s_dirtyclusters_counter, fs->dirty);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_FLIP, bit, 1),
+			-ENOSPC);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_SET,
+			EVFS_TEST_META, 64), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, memcmp(fs->bitmap, fs->orig, EVFS_TEST_BLOCKSIZE),
+			0);
+	KUNIT_EXPECT_EQ(test, fs->eg.eg_changed, 0);
+
+	// setting bits that are already set claims nothing
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_SET, 0, 64), 1);
+	KUNIT_EXPECT_EQ(test, percpu_counter_sum(
+			&fs->sbi.s_dirtyclusters_counter), fs->free);
+	evfs_test_check_coherent(test);
+}
+
+/* A block mballoc is handing out, used in its bitmap only, isn't set */
+static void test_buddy_busy(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	ext4_grpblk_t bit = evfs_test_random_free(fs);
+	void *mb;
+
+	mb = kunit_kmalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, mb);
+	memcpy(mb, fs->bitmap, EVFS_TEST_BLOCKSIZE);
+	ext4_set_bit(bit, mb);
+	fs->mb = mb;
+
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_SET, bit, 1),
+			-EBUSY);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_FLIP, bit, 1),
+			-EBUSY);
+	KUNIT_EXPECT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_SET,
+			clamp(bit - 20, EVFS_TEST_META, EVFS_TEST_CLUSTERS - 40),
+			40), -EBUSY);
+	KUNIT_EXPECT_EQ(test, memcmp(fs->bitmap, fs->orig, EVFS_TEST_BLOCKSIZE),
+			0);
+	// nor is it tracked, so a later clear can't free it
+	KUNIT_EXPECT_FALSE(test, ext4_evfs_track_covers(fs->track, mb, bit, 1));
+	// the fixture has no buddy of its own
+	fs->mb = NULL;
+	evfs_test_check_coherent(test);
+}
+
+/*
+ * A session is checked on a copy of the bits and claims, so its ops see
+ * each other's changes while the group itself is left alone; the
+ * clusters it claimed are used up before any more are.
+ */
+static void test_session_check(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	struct ext4_evfs_track claims = { 0 };
+	ext4_grpblk_t bit = evfs_test_random_free(fs), busy;
+	struct ext4_evfs_entry ent = { .ee_len = 1 };
+	struct ext4_evfs_req req = {
+		.rq_mode = EXT4_EVFS_FLIP,
+		.rq_ents = &ent,
+		.rq_count = 1,
+		.rq_reserved = 1,
+	};
+	void *bm, *mb;
+	u64 claim = 0;
+
+	bm = kunit_kmalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	mb = kunit_kmalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	claims.et_bitmap = kunit_kzalloc(test, EVFS_TEST_BLOCKSIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, bm);
+	KUNIT_ASSERT_NOT_NULL(test, mb);
+	KUNIT_ASSERT_NOT_NULL(test, claims.et_bitmap);
+	memcpy(bm, fs->bitmap, EVFS_TEST_BLOCKSIZE);
+
+	// set, then cleared again by a later op of the same session
+	ent.ee_offset = bit;
+	KUNIT_EXPECT_EQ(test, ext4_evfs_session_check_ent(&fs->eg,
+			EXT4_EVFS_FLIP, bm, &claims, &ent, &claim), 0);
+	KUNIT_EXPECT_TRUE(test, ext4_test_bit(bit, bm));
+	KUNIT_EXPECT_EQ(test, claim, 1);
+	KUNIT_EXPECT_EQ(test, ext4_evfs_session_check_ent(&fs->eg,
+			EXT4_EVFS_CLEAR, bm, &claims, &ent, &claim), 0);
+	KUNIT_EXPECT_FALSE(test, ext4_test_bit(bit, bm));
+	ent.ee_offset = 10;
+	KUNIT_EXPECT_EQ(test, ext4_evfs_session_check_ent(&fs->eg,
+			EXT4_EVFS_CLEAR, bm, &claims, &ent, &claim), -EPERM);
+
+	memcpy(mb, fs->bitmap, EVFS_TEST_BLOCKSIZE);
+	do {
+		busy = evfs_test_random_free(fs);
+	} while (busy == bit);
+	ext4_set_bit(busy, mb);
+	fs->eg.eg_buddy.bd_bitmap = mb;
+	ent.ee_offset = busy;
+	KUNIT_EXPECT_EQ(test, ext4_evfs_session_check_ent(&fs->eg,
+			EXT4_EVFS_SET, bm, &claims, &ent, &claim), -EBUSY);
+	fs->eg.eg_buddy.bd_bitmap = NULL;
+	KUNIT_EXPECT_EQ(test, memcmp(fs->bitmap, fs->orig, EVFS_TEST_BLOCKSIZE),
+			0);
+
+	// with nothing left to claim, the reserved cluster still does
+	percpu_counter_set(&fs->sbi.s_dirtyclusters_counter, fs->free);
+	ent.ee_offset = bit;
+	KUNIT_EXPECT_EQ(test, evfs_test_run(fs, &req), 1);
+	KUNIT_EXPECT_EQ(test, req.rq_reserved, 0);
+	KUNIT_EXPECT_EQ(test, fs->eg.eg_claimed, 1);
+	// and group_end drops it as the cluster leaves the free count
+	fs->dirty = fs->free - 1;
+	evfs_test_check_coherent(test);
+}
+
+/*
+ * Random set and clear ranges: a clear must succeed exactly when none
+ * of the range's set bits were there before EVFS, and the counters and
+ * checksum must stay in step throughout.
+ */
+static void test_counters(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		ext4_grpblk_t len = 1 + prandom_u32_state(&fs->rnd) % 300;
+		ext4_grpblk_t start = EVFS_TEST_META +
+			prandom_u32_state(&fs->rnd) %
+			(EVFS_TEST_CLUSTERS - EVFS_TEST_META - len);
+		bool set = prandom_u32_state(&fs->rnd) & 1;
+		int ret;
+
+		if (set) {
+			KUNIT_ASSERT_EQ(test, evfs_test_apply(fs,
+					EXT4_EVFS_SET, start, len), 1);
+			continue;
+		}
+		ret = evfs_test_unclaimed(fs, start, len) ? -EPERM : 0;
+		KUNIT_ASSERT_EQ(test, evfs_test_apply(fs, EXT4_EVFS_CLEAR,
+				start, len), ret);
+		if (i % 50 == 0)
+			evfs_test_check_coherent(test);
+	}
+	evfs_test_check_coherent(test);
+}
+
+/*
+ * Claims outgrowing the run array move to a bitmap and come back. Made in
+ * one operation, they are also too many runs for checksum deltas.
+ */
+static void test_tracker_forms(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	struct ext4_evfs_track *et = fs->track;
+	struct ext4_evfs_req req = { .rq_mode = EXT4_EVFS_FLIP };
+	struct ext4_evfs_entry *ents;
+	ext4_grpblk_t bit;
+	int i, n = 0;
+
+	ents = kunit_kcalloc(test, EXT4_EVFS_TRACK_RUNS + 1, sizeof(*ents),
+			     GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ents);
+	// every other free bit, so no two claims share a run
+	for (bit = EVFS_TEST_META; n <= EXT4_EVFS_TRACK_RUNS; bit += 2) {
+		if (ext4_test_bit(bit, fs->bitmap) ||
+		    ext4_test_bit(bit + 1, fs->bitmap))
+			continue;
+		ents[n].ee_block = ents[n].ee_offset = bit;
+		ents[n].ee_len = 1;
+		ents[n].ee_idx = n;
+		n++;
+	}
+	req.rq_ents = ents;
+	req.rq_count = n;
+	KUNIT_ASSERT_EQ(test, evfs_test_run(fs, &req), 1);
+	KUNIT_EXPECT_EQ(test, req.rq_changed, n);
+	KUNIT_EXPECT_NOT_NULL(test, et->et_bitmap);
+	KUNIT_EXPECT_EQ(test, et->et_nr_runs, 0);
+	KUNIT_EXPECT_EQ(test, et->et_count, n);
+	// too many runs for deltas: the checksum is recomputed in full
+	KUNIT_EXPECT_TRUE(test, fs->eg.eg_csum_full);
+	evfs_test_check_coherent(test);
+
+	for (i = EVFS_TEST_META; i < bit; i++)
+		if (ext4_test_bit(i, fs->bitmap) && !ext4_test_bit(i, fs->orig))
+			KUNIT_ASSERT_EQ(test, evfs_test_apply(fs,
+					EXT4_EVFS_FLIP, i, 1), 0);
+	KUNIT_EXPECT_NULL(test, et->et_bitmap);
+	KUNIT_EXPECT_EQ(test, et->et_count, 0);
+	evfs_test_check_coherent(test);
+}
+
+static void test_set_clear_bits(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		int len = 1 + prandom_u32_state(&fs->rnd) % 200;
+		int start = prandom_u32_state(&fs->rnd) %
+			    (EVFS_TEST_CLUSTERS - len);
+		int before = evfs_test_weight(fs->bitmap);
+		int in_range = evfs_test_count(fs->bitmap, start, start + len);
+
+		KUNIT_EXPECT_EQ(test, ext4_evfs_count_bits(fs->bitmap, start,
+				len), in_range);
+		if (i & 1) {
+			KUNIT_EXPECT_EQ(test, ext4_evfs_set_bits(fs->bitmap,
+					start, len), in_range);
+			KUNIT_EXPECT_EQ(test, evfs_test_weight(fs->bitmap),
+					before + len - in_range);
+		} else {
+			KUNIT_EXPECT_EQ(test, ext4_evfs_clear_bits(fs->bitmap,
+					start, len), in_range);
+			KUNIT_EXPECT_EQ(test, evfs_test_weight(fs->bitmap),
+					before - in_range);
+		}
+	}
+}
+
+static void test_copy_bits(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	u8 dst[64];
+	int i, j;
+
+	for (i = 0; i < 100; i++) {
+		unsigned int dbit = prandom_u32_state(&fs->rnd) % 64;
+		unsigned int sbit = prandom_u32_state(&fs->rnd) %
+				    (EVFS_TEST_CLUSTERS - 256);
+		unsigned int n = prandom_u32_state(&fs->rnd) %
+				 (sizeof(dst) * 8 - dbit);
+
+		memset(dst, 0xa5, sizeof(dst));
+		ext4_evfs_copy_bits(dst, dbit, fs->bitmap, sbit, n);
+		for (j = 0; j < n; j++)
+			KUNIT_ASSERT_EQ(test, !!ext4_test_bit(dbit + j, dst),
+					!!ext4_test_bit(sbit + j, fs->bitmap));
+		// and nothing either side of it was touched
+		if (dbit)
+			KUNIT_ASSERT_EQ(test, !!ext4_test_bit(dbit - 1, dst),
+					!!((0xa5 >> ((dbit - 1) % 8)) & 1));
+	}
+}
+
+/* Report the ns per iteration of @body, run @n times */
+#define EVFS_BENCH(test, what, n, body)					\
+do {									\
+	u64 __t0 = ktime_get_ns();					\
+	long __i;							\
+									\
+	for (__i = 0; __i < (n); __i++)					\
+		body;							\
+	kunit_info(test, "%s: %llu ns\n", what,				\
+		   div64_u64(ktime_get_ns() - __t0, (n)));		\
+} while (0)
+
+static void bench_bitmap(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	int span = EVFS_TEST_CLUSTERS - EVFS_TEST_META;
+
+	EVFS_BENCH(test, "set+clear a whole group", 10000, ({
+		ext4_evfs_set_bits(fs->bitmap, EVFS_TEST_META, span);
+		ext4_evfs_clear_bits(fs->bitmap, EVFS_TEST_META, span);
+	}));
+	EVFS_BENCH(test, "set+clear 7 unaligned bits", 1000000, ({
+		ext4_evfs_set_bits(fs->bitmap, EVFS_TEST_META + 3, 7);
+		ext4_evfs_clear_bits(fs->bitmap, EVFS_TEST_META + 3, 7);
+	}));
+}
+
+/* A flip and its undo, each a whole group operation less the I/O */
+static void bench_flip(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	ext4_grpblk_t bits[256];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(bits); i++)
+		bits[i] = evfs_test_random_free(fs);
+	EVFS_BENCH(test, "flip+unflip", 100000, ({
+		ext4_grpblk_t b = bits[__i % ARRAY_SIZE(bits)];
+
+		evfs_test_apply(fs, EXT4_EVFS_FLIP, b, 1);
+		evfs_test_apply(fs, EXT4_EVFS_FLIP, b, 1);
+	}));
+	evfs_test_check_coherent(test);
+}
+
+/* An incremental checksum update against rehashing the whole bitmap */
+static void bench_csum(struct kunit *test)
+{
+	struct evfs_test_fs *fs = test->priv;
+	static volatile u32 sink;
+
+	EVFS_BENCH(test, "csum delta of one bit", 100000,
+		   sink = ext4_evfs_csum_delta(&fs->sb, 5000, 5001));
+	EVFS_BENCH(test, "csum delta of 300 bits", 100000,
+		   sink = ext4_evfs_csum_delta(&fs->sb, 5000, 5300));
+	EVFS_BENCH(test, "full bitmap csum", 10000,
+		   sink = ext4_chksum(&fs->sbi, fs->sbi.s_csum_seed,
+				      fs->bitmap, EVFS_TEST_BLOCKSIZE));
+}
+
+static struct kunit_case ext4_evfs_test_cases[] = {
+	KUNIT_CASE(test_flip),
+	KUNIT_CASE(test_unclaimed),
+	KUNIT_CASE(test_enospc),
+	KUNIT_CASE(test_buddy_busy),
+	KUNIT_CASE(test_session_check),
+	KUNIT_CASE(test_counters),
+	KUNIT_CASE(test_tracker_forms),
+	KUNIT_CASE(test_set_clear_bits),
+	KUNIT_CASE(test_copy_bits),
+	KUNIT_CASE_SLOW(bench_bitmap),
+	KUNIT_CASE_SLOW(bench_flip),
+	KUNIT_CASE_SLOW(bench_csum),
+	{}
+};
+
+static struct kunit_suite ext4_evfs_test_suite = {
+	.name = "ext4_evfs_test",
+	.init = evfs_test_init,
+	.exit = evfs_test_exit,
+	.test_cases = ext4_evfs_test_cases,
+};
+
+kunit_test_suites(&ext4_evfs_test_suite);
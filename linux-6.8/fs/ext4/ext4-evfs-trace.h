@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * EVFS tracepoints. An operation is bracketed by ext4_evfs_enter and
+ * ext4_evfs_exit; in between each phase fires once it is done, so the gap
+ * since the previous event on the same task is how long the phase took.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ext4_evfs
+
+#if !defined(_EXT4_EVFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _EXT4_EVFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define show_evfs_mode(mode) __print_symbolic(mode,	\
+	{ EXT4_EVFS_FLIP,	"FLIP" },		\
+	{ EXT4_EVFS_SET,	"SET" },		\
+	{ EXT4_EVFS_CLEAR,	"CLEAR" })
+
+TRACE_DEFINE_ENUM(EXT4_EVFS_FLIP);
+TRACE_DEFINE_ENUM(EXT4_EVFS_SET);
+TRACE_DEFINE_ENUM(EXT4_EVFS_CLEAR);
+
+TRACE_EVENT(ext4_evfs_enter,
+	TP_PROTO(struct super_block *sb, bool inodes, int mode, u32 count),
+
+	TP_ARGS(sb, inodes, mode, count),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,	dev			)
+		__field(	bool,	inodes			)
+		__field(	int,	mode			)
+		__field(	u32,	count			)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->inodes	= inodes;
+		__entry->mode	= mode;
+		__entry->count	= count;
+	),
+
+	TP_printk("dev %d,%d %s %s count %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->inodes ? "inode" : "block",
+		  show_evfs_mode(__entry->mode), __entry->count)
+);
+
+TRACE_EVENT(ext4_evfs_exit,
+	TP_PROTO(struct super_block *sb, bool inodes, int mode, u32 count,
+		 u64 changed, int ret),
+
+	TP_ARGS(sb, inodes, mode, count, changed, ret),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,	dev			)
+		__field(	bool,	inodes			)
+		__field(	int,	mode			)
+		__field(	u32,	count			)
+		__field(	u64,	changed			)
+		__field(	int,	ret			)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->inodes	= inodes;
+		__entry->mode	= mode;
+		__entry->count	= count;
+		__entry->changed = changed;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("dev %d,%d %s %s count %u changed %llu ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->inodes ? "inode" : "block",
+		  show_evfs_mode(__entry->mode), __entry->count,
+		  __entry->changed, __entry->ret)
+);
+
+/* A group-level phase: reading its bitmap, write access, dirtying */
+DECLARE_EVENT_CLASS(ext4_evfs_group_phase,
+	TP_PROTO(struct super_block *sb, ext4_group_t group, int ret),
+
+	TP_ARGS(sb, group, ret),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	ext4_group_t,	group		)
+		__field(	int,		ret		)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->group	= group;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("dev %d,%d group %u ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->group, __entry->ret)
+);
+
+DEFINE_EVENT(ext4_evfs_group_phase, ext4_evfs_read_bitmap,
+	TP_PROTO(struct super_block *sb, ext4_group_t group, int ret),
+	TP_ARGS(sb, group, ret)
+);
+
+DEFINE_EVENT(ext4_evfs_group_phase, ext4_evfs_write_access,
+	TP_PROTO(struct super_block *sb, ext4_group_t group, int ret),
+	TP_ARGS(sb, group, ret)
+);
+
+DEFINE_EVENT(ext4_evfs_group_phase, ext4_evfs_dirty_metadata,
+	TP_PROTO(struct super_block *sb, ext4_group_t group, int ret),
+	TP_ARGS(sb, group, ret)
+);
+
+/*
+ * Journal handle phases. For ext4_evfs_journal_extend a ret of 1 means
+ * the handle had to be restarted in a new transaction.
+ */
+DECLARE_EVENT_CLASS(ext4_evfs_journal,
+	TP_PROTO(struct super_block *sb, int credits, int ret),
+
+	TP_ARGS(sb, credits, ret),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,	dev			)
+		__field(	int,	credits			)
+		__field(	int,	ret			)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->credits = credits;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("dev %d,%d credits %d ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->credits, __entry->ret)
+);
+
+DEFINE_EVENT(ext4_evfs_journal, ext4_evfs_journal_start,
+	TP_PROTO(struct super_block *sb, int credits, int ret),
+	TP_ARGS(sb, credits, ret)
+);
+
+DEFINE_EVENT(ext4_evfs_journal, ext4_evfs_journal_extend,
+	TP_PROTO(struct super_block *sb, int credits, int ret),
+	TP_ARGS(sb, credits, ret)
+);
+
+DEFINE_EVENT(ext4_evfs_journal, ext4_evfs_journal_stop,
+	TP_PROTO(struct super_block *sb, int credits, int ret),
+	TP_ARGS(sb, credits, ret)
+);
+
+/*
+ * One entry applied: @old is how many of its bits were set beforehand
+ * (-1 if it was rejected), @state its new state or the error.
+ */
+TRACE_EVENT(ext4_evfs_apply,
+	TP_PROTO(struct super_block *sb, u64 block, ext4_group_t group,
+		 ext4_grpblk_t offset, ext4_grpblk_t len, int old, int state),
+
+	TP_ARGS(sb, block, group, offset, len, old, state),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	u64,		block		)
+		__field(	ext4_group_t,	group		)
+		__field(	ext4_grpblk_t,	offset		)
+		__field(	ext4_grpblk_t,	len		)
+		__field(	int,		old		)
+		__field(	int,		state		)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->block	= block;
+		__entry->group	= group;
+		__entry->offset	= offset;
+		__entry->len	= len;
+		__entry->old	= old;
+		__entry->state	= state;
+	),
+
+	TP_printk("dev %d,%d block %llu group %u offset %d len %d old %d state %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->block, __entry->group, __entry->offset,
+		  __entry->len, __entry->old, __entry->state)
+);
+
+#endif /* _EXT4_EVFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ext4-evfs-trace
+#include <trace/define_trace.h>
@@ -3,6 +3,7 @@
 #include <linux/time.h>
 #include <linux/compat.h>
 #include <linux/mount.h>
+#include <linux/namei.h>
 #include <linux/file.h>
 #include <linux/quotaops.h>
 #include <linux/random.h>
@@ -11,129 +12,4729 @@
 #include <linux/iversion.h>
 #include <linux/fileattr.h>
 #include <linux/uuid.h>
+#include <linux/sort.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/anon_inodes.h>
+#include <linux/xarray.h>
+#include <linux/percpu-rwsem.h>
+#include <linux/io_uring/cmd.h>
+#include <linux/crc32.h>
+#include <linux/sched/clock.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/eventfd.h>
+#include <linux/workqueue.h>
+#include <linux/blkdev.h>
 #include "ext4_jbd2.h"
 #include "ext4.h"
+#include "mballoc.h"
 #include <linux/fsmap.h>
 #include "fsmap.h"
 #include <trace/events/ext4.h>
 #include "ext4-evfs.h"
 
-long __ext4_evfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
-    struct inode *inode = file_inode(filp);
-	struct super_block *sb = inode->i_sb;
+/*
+ * Largest number of entries accepted by one batched call, so a single
+ * request can't pin an unbounded amount of kernel memory.
+ */
+#define EXT4_EVFS_MAX_BATCH		(1U << 20)
+
+/*
+ * Block groups whose bitmaps are read ahead of the one being worked on,
+ * so cold bitmaps are read in parallel rather than one after another.
+ */
+#define EXT4_EVFS_READAHEAD_GROUPS	256
+
+/*
+ * Largest number of bits returned in one prior-state bitmap, which is
+ * staged in kernel memory (16MiB) before being copied out.
+ */
+#define EXT4_EVFS_MAX_BITS		(1U << 27)
+
+/*
+ * Largest block bitmap map, header included. It is vmalloc()ed kernel
+ * memory for as long as a map fd is open; 512MiB covers 16TiB of 4KiB
+ * blocks.
+ */
+#define EXT4_EVFS_MAX_MAP		(512UL << 20)
+
+/*
+ * Most block groups whose credits are reserved at once. Larger operations
+ * extend or restart their handle every this many groups. It is also the
+ * most a session may touch, as its commit holds all their locks at once.
+ */
+#define EXT4_EVFS_GROUPS_PER_HANDLE	64
+
+/*
+ * Most asynchronous submissions a submitter fd keeps, queued or done but
+ * not yet collected, before EXT4_IOC_SUBMIT_BLOCK_BITS fails with EAGAIN.
+ */
+#define EXT4_EVFS_MAX_TICKETS		4096
+
+/*
+ * Most runs of changed bits whose checksum contribution is worked out one
+ * by one. Each costs a crc32c shift, so past this many a group's bitmap
+ * checksum is recomputed in full instead.
+ */
+#define EXT4_EVFS_CSUM_DELTA_RUNS	16
+
+enum ext4_evfs_mode {
+	EXT4_EVFS_FLIP,
+	EXT4_EVFS_SET,
+	EXT4_EVFS_CLEAR,
+};
+
+// the tracepoints print modes by name
+#define CREATE_TRACE_POINTS
+#include "ext4-evfs-trace.h"
+
+/*
+ * One validated piece of a request: bits [ee_offset, ee_offset + ee_len)
+ * of group ee_group. Entries are sorted so those of a group are adjacent.
+ */
+struct ext4_evfs_entry {
+	ext4_fsblk_t	ee_block;	/* first block covered, or inode */
+	ext4_group_t	ee_group;
+	ext4_grpblk_t	ee_offset;	/* first bit within the group's bitmap */
+	ext4_grpblk_t	ee_len;
+	u32		ee_idx;		/* position in the caller's request */
+};
+
+/*
+ * One EVFS operation: what to do to which bits, and where results go.
+ * ext4_evfs_run() fills in the outputs.
+ */
+struct ext4_evfs_req {
+	int			rq_mode;	/* enum ext4_evfs_mode */
+	struct ext4_evfs_entry	*rq_ents;
+	u32			rq_count;
+	__s32			*rq_status;	/* per-entry result, optional */
+	void			*rq_prior;	/* prior-state bitmap, optional */
+	u64			rq_changed;	/* bits actually changed */
+	tid_t			rq_tid;		/* transaction that holds them */
+	u64			rq_reserved;	/* clusters claimed beforehand */
+};
+
+/*
+ * One EXT4_IOC_SUBMIT_BLOCK_BITS call, from submission until its ticket
+ * is collected or its submitter fd is closed. The worker fills in the
+ * result fields before aj_done.
+ */
+struct ext4_evfs_async_job {
+	struct list_head	aj_list;	/* on ei_async_queue */
+	struct ext4_evfs_submitter *aj_submitter;
+	u32			aj_ticket;
+	int			aj_mode;	/* enum ext4_evfs_mode */
+	u32			aj_flags;	/* EXT4_EVFS_DURABLE_FLAGS */
+	u32			aj_count;
+	struct ext4_evfs_entry	*aj_ents;	/* freed once applied */
+	struct file		*aj_file;	/* pinned, with write access */
+	struct eventfd_ctx	*aj_eventfd;	/* optional */
+	int			aj_result;
+	tid_t			aj_tid;
+	bool			aj_done;
+};
+
+/* One call queued on a session fd */
+struct ext4_evfs_session_op {
+	struct list_head	so_list;	/* on es_ops */
+	int			so_mode;	/* enum ext4_evfs_mode */
+	u32			so_count;
+	u32			so_next;	/* first entry not yet seen */
+	struct ext4_evfs_entry	*so_ents;	/* sorted */
+};
+
+/* What an open session fd holds on to */
+struct ext4_evfs_session {
+	struct mutex		es_lock;	/* serialises queue and commit */
+	struct list_head	es_ops;
+	u64			es_bits;
+	unsigned int		es_nr_groups;
+	/* the groups queued ops touch, sorted */
+	ext4_group_t		es_groups[EXT4_EVFS_GROUPS_PER_HANDLE];
+	struct ext4_evfs_info	*es_ei;
+	struct file		*es_file;	/* pins the mount */
+};
+
+/*
+ * State of one block group while an EVFS operation has its bitmap and
+ * descriptor open for write under a journal handle. The group lock is
+ * held from ext4_evfs_group_begin() to ext4_evfs_group_end(). Reading,
+ * journal access and allocation happen before it is taken and dirtying
+ * after it is dropped, so it covers only the in-memory change and
+ * operations on different groups don't wait for each other.
+ */
+struct ext4_evfs_group {
+	ext4_group_t		eg_group;
+	struct buffer_head	*eg_bitmap_bh;
+	struct buffer_head	*eg_gdp_bh;	// buffer for group descriptor block
+	struct ext4_group_desc	*eg_gdp;
+	int			eg_free_delta;	/* change in free clusters */
+	unsigned int		eg_claimed;	/* clusters claimed for it */
+	unsigned int		eg_changed;	/* bits actually changed */
+	ext4_grpblk_t		eg_first;	/* bounds of the bits touched */
+	ext4_grpblk_t		eg_last;
+	u32			eg_csum_delta;	/* bitmap crc32c change */
+	unsigned int		eg_csum_runs;	/* runs folded into it */
+	bool			eg_csum_full;	/* recompute it instead */
+	struct ext4_buddy	eg_buddy;	/* mballoc's copy, if cached */
+	unsigned int		eg_buddy_cleared; /* its pages, bitmap (1) and
+						   * buddy (2), we marked out
+						   * of date */
+	bool			eg_buddy_shared; /* pages locked for the group
+						  * before it */
+	struct ext4_evfs_group_stats *eg_stats;
+	struct ext4_evfs_track	*eg_track;	/* EVFS claims in the group */
+	unsigned long		eg_track_slot;	/* its ext4_evfs_track_slot() */
+	void			*eg_track_spare; /* for its bitmap form */
+	struct buffer_head	*eg_track_bh;	/* tracker file block 2 * slot */
+	struct buffer_head	*eg_track_bitmap_bh; /* and the one after */
+	bool			eg_track_dirty;	/* tracker changed */
+	bool			eg_track_bitmap_used; /* stored in bitmap form */
+};
+
+static int ext4_evfs_entry_cmp(const void *a, const void *b)
+{
+	const struct ext4_evfs_entry *ea = a, *eb = b;
+
+	if (ea->ee_block != eb->ee_block)
+		return ea->ee_block < eb->ee_block ? -1 : 1;
+	// keep duplicates in submission order so repeated flips compose
+	return ea->ee_idx < eb->ee_idx ? -1 : ea->ee_idx > eb->ee_idx;
+}
+
+/*
+ * EVFS ops address one bitmap bit per block; with bigalloc a bit covers a
+ * whole cluster, which per-block results can't describe.
+ */
+static int ext4_evfs_check_sb(struct super_block *sb, bool write)
+{
+	if (ext4_has_feature_bigalloc(sb))
+		return -EOPNOTSUPP;
+	if (write && sb_rdonly(sb))
+		return -EROFS;
+	return 0;
+}
+
+/*
+ * Fast commits have no tags for bitmap or descriptor changes, so a
+ * transaction EVFS has changed anything in must commit in full. Called
+ * with every handle EVFS starts, and again whenever one is restarted.
+ */
+static void ext4_evfs_fc_ineligible(struct super_block *sb, handle_t *handle)
+{
+	if (ext4_handle_valid(handle))
+		ext4_fc_mark_ineligible(sb, EXT4_FC_REASON_RESIZE, handle);
+}
+
+static bool ext4_evfs_block_valid(struct super_block *sb, __u64 block)
+{
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+
+	return block >= le32_to_cpu(es->s_first_data_block) &&
+	       block < ext4_blocks_count(es);
+}
+
+/*
+ * Statistics, shown in /proc/fs/ext4/<dev>/evfs_stats. Each CPU counts
+ * into its own copy so the hot path never shares a cacheline; reads fold
+ * them. They go with the rest of the EVFS state, so they cover the time
+ * since something last started using EVFS, and the file is only there
+ * while something is.
+ */
+enum ext4_evfs_stat_op {
+	EXT4_EVFS_OP_BLOCK,		/* + enum ext4_evfs_mode */
+	EXT4_EVFS_OP_INODE = EXT4_EVFS_OP_BLOCK + 3,
+	EXT4_EVFS_OP_QUERY = EXT4_EVFS_OP_INODE + 3,
+	EXT4_EVFS_NR_OPS,
+};
+
+enum ext4_evfs_phase {
+	EXT4_EVFS_PH_OP,		/* a whole operation */
+	EXT4_EVFS_PH_JOURNAL_START,	/* starting or extending a handle */
+	EXT4_EVFS_PH_READ_BITMAP,
+	EXT4_EVFS_PH_WRITE_ACCESS,
+	EXT4_EVFS_PH_DIRTY,
+	EXT4_EVFS_PH_JOURNAL_STOP,
+	EXT4_EVFS_NR_PHASES,
+};
+
+/* Latency bucket b counts times in [2^b, 2^(b+1)) ns; the last is open */
+#define EXT4_EVFS_LAT_BUCKETS		32
+
+static const int ext4_evfs_stat_errnos[] = {
+	EPERM, EINVAL, ENOMEM, EIO, ENOSPC, EROFS, EFSCORRUPTED, EFSBADCRC,
+	EBUSY,
+};
+
+struct ext4_evfs_stats {
+	u64	es_ops[EXT4_EVFS_NR_OPS];
+	u64	es_bits_set;
+	u64	es_bits_cleared;
+	u64	es_errors[ARRAY_SIZE(ext4_evfs_stat_errnos) + 1]; /* + other */
+	u64	es_journal_restarts;
+	u64	es_latency[EXT4_EVFS_NR_PHASES][EXT4_EVFS_LAT_BUCKETS];
+};
+
+/*
+ * What /proc/fs/ext4/<dev>/evfs_groups shows of a group besides its
+ * claims. Created on the group's first EVFS operation and updated under
+ * its group lock.
+ */
+struct ext4_evfs_group_stats {
+	u64		gs_ops;
+	time64_t	gs_last;	/* wall clock seconds of the last op */
+};
+
+/*
+ * Per-filesystem EVFS state. Set up by the first EVFS call and torn down
+ * when the last user is done with it: each call holds a reference while
+ * it runs, and each fd EVFS hands out holds one until it is closed. All
+ * of them pin the mount, so nothing is left by the time it goes away.
+ * Claims are always on disk in the tracker file, so the in-memory copy
+ * can be dropped at any time and read back.
+ */
+struct ext4_evfs_info {
+	refcount_t		ei_ref;
+	struct rcu_head		ei_rcu;
+	struct super_block	*ei_sb;
+	struct mutex		ei_map_lock;	/* serialises map setup/teardown */
+	struct ext4_evfs_map __rcu *ei_map;
+	struct xarray		ei_track;	/* slot -> ext4_evfs_track */
+	struct mutex		ei_track_lock;	/* loads and creates trackers */
+	struct mutex		ei_session_lock; /* serialises session commits */
+	struct inode		*ei_track_inode; /* the tracker file; there is
+						  * one before anything is
+						  * claimed */
+	__u32			ei_track_csum_seed;
+	struct ext4_evfs_stats __percpu *ei_stats;
+	struct xarray		ei_groups;	/* group -> ext4_evfs_group_stats */
+	struct workqueue_struct	*ei_async_wq;	/* ordered, on first use */
+	struct work_struct	ei_async_work;
+	spinlock_t		ei_async_lock;	/* protects ei_async_queue */
+	struct list_head	ei_async_queue;	/* jobs submitted, in order */
+	wait_queue_head_t	ei_async_wait;	/* woken as jobs complete */
+};
+
+/*
+ * Read-only shadow of every group's block bitmap, shared by all map fds
+ * of a filesystem. Laid out as struct ext4_evfs_map_header (with one
+ * sequence counter per group) followed, on a page boundary, by the
+ * group bitmaps back to back.
+ */
+struct ext4_evfs_map {
+	void			*em_buf;	/* vmalloc_user() area */
+	struct ext4_evfs_map_header *em_hdr;
+	void			*em_bitmap;
+	ext4_group_t		em_groups;
+	unsigned int		em_group_bytes;
+	int			em_users;	/* protected by ei_map_lock */
+};
+
+/* What an open map fd holds on to */
+struct ext4_evfs_map_file {
+	struct ext4_evfs_info	*mf_ei;
+	struct ext4_evfs_map	*mf_map;
+	struct file		*mf_file;	/* pins the mount */
+};
+
+/* Sets up and tears down EVFS state, and creates tracker files */
+static DEFINE_MUTEX(ext4_evfs_setup_lock);
+
+/*
+ * Make @inode the tracker file, with a checksum seed for its blocks as
+ * for the orphan file. Lockless readers see both or neither.
+ */
+static void ext4_evfs_track_set_inode(struct ext4_evfs_info *ei,
+				      struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	__le32 inum = cpu_to_le32(inode->i_ino);
+	__le32 gen = cpu_to_le32(inode->i_generation);
+	__u32 csum;
+
+	csum = ext4_chksum(sbi, sbi->s_csum_seed, (__u8 *)&inum, sizeof(inum));
+	ei->ei_track_csum_seed = ext4_chksum(sbi, csum, (__u8 *)&gen,
+					     sizeof(gen));
+	smp_store_release(&ei->ei_track_inode, inode);
+}
+
+static inline void ext4_evfs_stat_op(struct ext4_evfs_info *ei, int op)
+{
+	this_cpu_inc(ei->ei_stats->es_ops[op]);
+}
+
+/* Count the time since @start, taken with local_clock(), against @phase */
+static void ext4_evfs_stat_latency(struct ext4_evfs_info *ei,
+				   enum ext4_evfs_phase phase, u64 start)
+{
+	u64 ns = local_clock() - start;
+	unsigned int b = 0;
+
+	if (ns)
+		b = min_t(unsigned int, ilog2(ns), EXT4_EVFS_LAT_BUCKETS - 1);
+	this_cpu_inc(ei->ei_stats->es_latency[phase][b]);
+}
+
+static void ext4_evfs_stat_error(struct ext4_evfs_info *ei, int err)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(ext4_evfs_stat_errnos); i++)
+		if (err == -ext4_evfs_stat_errnos[i])
+			break;
+	this_cpu_inc(ei->ei_stats->es_errors[i]);
+}
+
+/* A group had @changed bits changed, @free_delta more cleared than set */
+static void ext4_evfs_stat_bits(struct ext4_evfs_info *ei,
+				unsigned int changed, int free_delta)
+{
+	this_cpu_add(ei->ei_stats->es_bits_set,
+		     ((int)changed - free_delta) / 2);
+	this_cpu_add(ei->ei_stats->es_bits_cleared,
+		     ((int)changed + free_delta) / 2);
+}
+
+/*
+ * @group's ext4_evfs_group_stats, created if need be. NULL if that fails:
+ * the group's operations just go uncounted.
+ */
+static struct ext4_evfs_group_stats *
+ext4_evfs_group_stats(struct ext4_evfs_info *ei, ext4_group_t group)
+{
+	struct ext4_evfs_group_stats *gs, *old;
+
+	gs = xa_load(&ei->ei_groups, group);
+	if (gs)
+		return gs;
+	gs = kzalloc(sizeof(*gs), GFP_NOFS);
+	if (!gs)
+		return NULL;
+	old = xa_cmpxchg(&ei->ei_groups, group, NULL, gs, GFP_NOFS);
+	if (old) {
+		kfree(gs);
+		return xa_is_err(old) ? NULL : old;
+	}
+	return gs;
+}
+
+/* Caller holds the group lock */
+static void ext4_evfs_group_stats_note(struct ext4_evfs_group_stats *gs)
+{
+	if (!gs)
+		return;
+	WRITE_ONCE(gs->gs_ops, gs->gs_ops + 1);
+	WRITE_ONCE(gs->gs_last, ktime_get_real_seconds());
+}
+
+static const char *const ext4_evfs_op_names[EXT4_EVFS_NR_OPS] = {
+	"block_flip", "block_set", "block_clear",
+	"inode_flip", "inode_set", "inode_clear",
+	"query",
+};
+
+static const char *const ext4_evfs_errno_names[] = {
+	"EPERM", "EINVAL", "ENOMEM", "EIO", "ENOSPC", "EROFS",
+	"EFSCORRUPTED", "EFSBADCRC", "EBUSY", "other",
+};
+
+/* Fold the per-CPU copies; every field is a u64, so as one array */
+static void ext4_evfs_stats_sum(struct ext4_evfs_info *ei,
+				struct ext4_evfs_stats *sum)
+{
+	u64 *from, *to = (u64 *)sum;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		from = (u64 *)per_cpu_ptr(ei->ei_stats, cpu);
+		for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+			to[i] += from[i];
+	}
+}
+
+static const char *const ext4_evfs_phase_names[EXT4_EVFS_NR_PHASES] = {
+	"op", "journal_start", "read_bitmap", "write_access",
+	"dirty_metadata", "journal_stop",
+};
+
+/*
+ * /proc/fs/ext4/<dev>/evfs_stats. Latency histograms are one
+ * "lower-bound-ns count" line per bucket under each phase's name.
+ */
+static int ext4_evfs_seq_stats_show(struct seq_file *seq, void *v)
+{
+	struct ext4_evfs_info *ei = seq->private;
+	struct ext4_evfs_stats *sum;
+	int i, b;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	ext4_evfs_stats_sum(ei, sum);
+
+	seq_puts(seq, "ops:\n");
+	for (i = 0; i < EXT4_EVFS_NR_OPS; i++)
+		seq_printf(seq, "  %s: %llu\n", ext4_evfs_op_names[i],
+			   sum->es_ops[i]);
+	seq_puts(seq, "errors:\n");
+	for (i = 0; i < ARRAY_SIZE(ext4_evfs_errno_names); i++)
+		seq_printf(seq, "  %s: %llu\n", ext4_evfs_errno_names[i],
+			   sum->es_errors[i]);
+	seq_printf(seq, "bits_set: %llu\n", sum->es_bits_set);
+	seq_printf(seq, "bits_cleared: %llu\n", sum->es_bits_cleared);
+	seq_printf(seq, "journal_restarts: %llu\n", sum->es_journal_restarts);
+	for (i = 0; i < EXT4_EVFS_NR_PHASES; i++) {
+		seq_printf(seq, "latency_%s:\n", ext4_evfs_phase_names[i]);
+		for (b = 0; b < EXT4_EVFS_LAT_BUCKETS; b++)
+			seq_printf(seq, "  %llu %llu\n", b ? 1ULL << b : 0,
+				   sum->es_latency[i][b]);
+	}
+	kfree(sum);
+	return 0;
+}
+
+static const struct seq_operations ext4_evfs_seq_groups_ops;
+static void ext4_evfs_async_work(struct work_struct *work);
+
+/*
+ * The tracker file, EXT4_EVFS_TRACK_NAME in the root directory, or NULL
+ * if there is none. Anything else by that name is logged and ignored:
+ * claims are then tracked in memory only, as before a tracker is created.
+ */
+static struct inode *ext4_evfs_track_open(struct super_block *sb)
+{
+	struct dentry *dentry;
+	struct inode *inode = NULL;
+
+	dentry = lookup_positive_unlocked(EXT4_EVFS_TRACK_NAME, sb->s_root,
+					  strlen(EXT4_EVFS_TRACK_NAME));
+	if (IS_ERR(dentry)) {
+		if (PTR_ERR(dentry) == -ENOENT)
+			return NULL;
+		return ERR_CAST(dentry);
+	}
+	// if something else has the name, changes fail until it's moved
+	if (d_is_reg(dentry))
+		inode = igrab(d_inode(dentry));
+	dput(dentry);
+	return inode;
+}
+
+static struct ext4_evfs_info *ext4_evfs_info_alloc(struct super_block *sb)
+{
+	struct ext4_evfs_info *ei;
+	struct inode *inode;
+	int err;
+
+	ei = kzalloc(sizeof(*ei), GFP_KERNEL);
+	if (!ei)
+		return ERR_PTR(-ENOMEM);
+	refcount_set(&ei->ei_ref, 1);
+	ei->ei_sb = sb;
+	mutex_init(&ei->ei_map_lock);
+	mutex_init(&ei->ei_track_lock);
+	mutex_init(&ei->ei_session_lock);
+	xa_init(&ei->ei_track);
+	xa_init(&ei->ei_groups);
+	INIT_WORK(&ei->ei_async_work, ext4_evfs_async_work);
+	spin_lock_init(&ei->ei_async_lock);
+	INIT_LIST_HEAD(&ei->ei_async_queue);
+	init_waitqueue_head(&ei->ei_async_wait);
+	err = -ENOMEM;
+	ei->ei_stats = alloc_percpu(struct ext4_evfs_stats);
+	if (!ei->ei_stats)
+		goto out_free;
+
+	// group trackers themselves are read as groups are first touched
+	inode = ext4_evfs_track_open(sb);
+	if (IS_ERR(inode)) {
+		err = PTR_ERR(inode);
+		goto out_stats;
+	}
+	if (inode)
+		ext4_evfs_track_set_inode(ei, inode);
+
+	// ext4_evfs_info_put() takes them down again, waiting out readers
+	if (EXT4_SB(sb)->s_proc) {
+		proc_create_seq_data("evfs_groups", 0444, EXT4_SB(sb)->s_proc,
+				     &ext4_evfs_seq_groups_ops, ei);
+		proc_create_single_data("evfs_stats", 0444, EXT4_SB(sb)->s_proc,
+					ext4_evfs_seq_stats_show, ei);
+	}
+	return ei;
+
+out_stats:
+	free_percpu(ei->ei_stats);
+out_free:
+	kfree(ei);
+	return ERR_PTR(err);
+}
+
+/* Take a reference to @sb's EVFS state, setting it up if there is none */
+static struct ext4_evfs_info *ext4_evfs_info_get(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_evfs_info *ei;
+
+	rcu_read_lock();
+	ei = rcu_dereference(sbi->s_evfs_info);
+	if (ei && refcount_inc_not_zero(&ei->ei_ref)) {
+		rcu_read_unlock();
+		return ei;
+	}
+	rcu_read_unlock();
+
+	// the last reference is only dropped under the lock
+	mutex_lock(&ext4_evfs_setup_lock);
+	ei = rcu_dereference_protected(sbi->s_evfs_info,
+			lockdep_is_held(&ext4_evfs_setup_lock));
+	if (ei) {
+		refcount_inc(&ei->ei_ref);
+	} else {
+		ei = ext4_evfs_info_alloc(sb);
+		if (!IS_ERR(ei))
+			rcu_assign_pointer(sbi->s_evfs_info, ei);
+	}
+	mutex_unlock(&ext4_evfs_setup_lock);
+	return ei;
+}
+
+/* Another reference for something that outlives the caller's */
+static struct ext4_evfs_info *ext4_evfs_info_hold(struct ext4_evfs_info *ei)
+{
+	refcount_inc(&ei->ei_ref);
+	return ei;
+}
+
+static void ext4_evfs_info_put(struct ext4_evfs_info *ei);
+
+/* @sb's EVFS state, which the caller holds a reference to */
+static struct ext4_evfs_info *ext4_evfs_info(struct super_block *sb)
+{
+	return rcu_dereference_protected(EXT4_SB(sb)->s_evfs_info, true);
+}
+
+/*
+ * Start reading @group's block bitmap unless it is cached or already on
+ * its way. Errors are left for whoever reads the bitmap for real.
+ */
+static void ext4_evfs_read_bitmap_ahead(struct super_block *sb,
+					ext4_group_t group)
+{
+	struct buffer_head *bh;
+
+	bh = ext4_read_block_bitmap_nowait(sb, group, true);
+	if (!IS_ERR_OR_NULL(bh))
+		brelse(bh);
+}
+
+/*
+ * Copy bytes [@from, @to) of @bitmap into the map's slot for @group.
+ * Caller holds the group lock, which serialises writers of a slot;
+ * readers retry while the group's sequence counter is odd or has moved.
+ */
+static void ext4_evfs_map_write(struct ext4_evfs_map *map,
+				ext4_group_t group, const void *bitmap,
+				unsigned int from, unsigned int to)
+{
+	__u32 *seq = &map->em_hdr->mh_seq[group];
+
+	WRITE_ONCE(*seq, *seq + 1);
+	smp_wmb();
+	memcpy(map->em_bitmap + (size_t)group * map->em_group_bytes + from,
+	       bitmap + from, to - from);
+	smp_wmb();
+	WRITE_ONCE(*seq, *seq + 1);
+}
+
+/*
+ * Bring @group's slot up to date with its cached bitmap. Only rewrites
+ * (and bumps the sequence counter) when the bits actually differ.
+ */
+static int ext4_evfs_map_sync_group(struct super_block *sb,
+				    struct ext4_evfs_map *map,
+				    ext4_group_t group)
+{
+	struct buffer_head *bitmap_bh;
+
+	bitmap_bh = ext4_read_block_bitmap(sb, group);
+	if (IS_ERR(bitmap_bh))
+		return PTR_ERR(bitmap_bh);
+	ext4_lock_group(sb, group);
+	if (memcmp(map->em_bitmap + (size_t)group * map->em_group_bytes,
+		   bitmap_bh->b_data, map->em_group_bytes))
+		ext4_evfs_map_write(map, group, bitmap_bh->b_data, 0,
+				    map->em_group_bytes);
+	ext4_unlock_group(sb, group);
+	brelse(bitmap_bh);
+	return 0;
+}
+
+static int ext4_evfs_map_sync(struct super_block *sb,
+			      struct ext4_evfs_map *map)
+{
+	ext4_group_t group, ahead = 0;
+	struct blk_plug plug;
+	int err;
+
+	for (group = 0; group < map->em_groups; group++) {
+		if (group == ahead) {
+			blk_start_plug(&plug);
+			for (; ahead < map->em_groups &&
+			       ahead < group + EXT4_EVFS_READAHEAD_GROUPS; ahead++)
+				ext4_evfs_read_bitmap_ahead(sb, ahead);
+			blk_finish_plug(&plug);
+		}
+		err = ext4_evfs_map_sync_group(sb, map, group);
+		if (err)
+			return err;
+		cond_resched();
+	}
+	return 0;
+}
+
+/*
+ * Mirror an EVFS change to bits [@start, @end) of @group into the map, if
+ * anyone has one. Caller holds the group lock.
+ */
+static void ext4_evfs_map_update(struct ext4_evfs_info *ei,
+				 ext4_group_t group, const void *bitmap,
+				 ext4_grpblk_t start, ext4_grpblk_t end)
+{
+	struct ext4_evfs_map *map;
+
+	rcu_read_lock();
+	map = rcu_dereference(ei->ei_map);
+	if (map && group < map->em_groups)
+		ext4_evfs_map_write(map, group, bitmap, start / 8,
+				    min_t(unsigned int, DIV_ROUND_UP(end, 8),
+					  map->em_group_bytes));
+	rcu_read_unlock();
+}
+
+static struct ext4_evfs_map *ext4_evfs_map_alloc(struct super_block *sb)
+{
+	struct ext4_evfs_map *map;
+	ext4_group_t ngroups = ext4_get_groups_count(sb);
+	size_t hdr_size, size;
+
+	hdr_size = PAGE_ALIGN(struct_size(map->em_hdr, mh_seq, ngroups));
+	size = hdr_size + PAGE_ALIGN((size_t)ngroups *
+				     (EXT4_CLUSTERS_PER_GROUP(sb) / 8));
+	if (size > EXT4_EVFS_MAX_MAP)
+		return ERR_PTR(-E2BIG);
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+	map->em_groups = ngroups;
+	map->em_group_bytes = EXT4_CLUSTERS_PER_GROUP(sb) / 8;
+	map->em_buf = vmalloc_user(size);
+	if (!map->em_buf) {
+		kfree(map);
+		return ERR_PTR(-ENOMEM);
+	}
+	map->em_hdr = map->em_buf;
+	map->em_bitmap = map->em_buf + hdr_size;
+
+	map->em_hdr->mh_magic = EXT4_EVFS_MAP_MAGIC;
+	map->em_hdr->mh_groups = ngroups;
+	map->em_hdr->mh_bits_per_group = EXT4_CLUSTERS_PER_GROUP(sb);
+	map->em_hdr->mh_bitmap_offset = hdr_size;
+	map->em_hdr->mh_size = size;
+	map->em_hdr->mh_first_block =
+		le32_to_cpu(EXT4_SB(sb)->s_es->s_first_data_block);
+	map->em_hdr->mh_blocks = ext4_blocks_count(EXT4_SB(sb)->s_es);
+	return map;
+}
+
+static void ext4_evfs_map_put(struct ext4_evfs_info *ei,
+			      struct ext4_evfs_map *map)
+{
+	mutex_lock(&ei->ei_map_lock);
+	if (--map->em_users) {
+		mutex_unlock(&ei->ei_map_lock);
+		return;
+	}
+	RCU_INIT_POINTER(ei->ei_map, NULL);
+	mutex_unlock(&ei->ei_map_lock);
+
+	synchronize_rcu();
+	vfree(map->em_buf);
+	kfree(map);
+}
+
+static int ext4_evfs_map_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ext4_evfs_map_file *mf = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+	return remap_vmalloc_range(vma, mf->mf_map->em_buf, vma->vm_pgoff);
+}
+
+static long ext4_evfs_map_ioctl(struct file *file, unsigned int cmd,
+				unsigned long arg)
+{
+	struct ext4_evfs_map_file *mf = file->private_data;
+
+	switch (cmd) {
+	case EXT4_IOC_MAP_SYNC:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return ext4_evfs_map_sync(file_inode(mf->mf_file)->i_sb,
+					  mf->mf_map);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int ext4_evfs_map_release(struct inode *inode, struct file *file)
+{
+	struct ext4_evfs_map_file *mf = file->private_data;
+
+	ext4_evfs_map_put(mf->mf_ei, mf->mf_map);
+	ext4_evfs_info_put(mf->mf_ei);
+	fput(mf->mf_file);
+	kfree(mf);
+	return 0;
+}
+
+static const struct file_operations ext4_evfs_map_fops = {
+	.mmap		= ext4_evfs_map_mmap,
+	.unlocked_ioctl	= ext4_evfs_map_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.release	= ext4_evfs_map_release,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Hand out an fd whose mapping is a read-only view of the whole
+ * filesystem's block bitmap. EVFS keeps it current for its own changes;
+ * EXT4_IOC_MAP_SYNC on the fd picks up changes made by the allocator.
+ * It shows where every file's data is, so it is as privileged as the
+ * changes are.
+ */
+static long ext4_evfs_ioctl_map_bitmap(struct file *filp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_info *ei;
+	struct ext4_evfs_map_file *mf;
+	struct ext4_evfs_map *map;
+	bool populate = false;
+	int fd, err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	err = ext4_evfs_check_sb(sb, false);
+	if (err)
+		return err;
+	ei = ext4_evfs_info(sb);
+	mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+	if (!mf)
+		return -ENOMEM;
+
+	mutex_lock(&ei->ei_map_lock);
+	map = rcu_dereference_protected(ei->ei_map,
+					lockdep_is_held(&ei->ei_map_lock));
+	if (!map) {
+		map = ext4_evfs_map_alloc(sb);
+		if (IS_ERR(map)) {
+			mutex_unlock(&ei->ei_map_lock);
+			kfree(mf);
+			return PTR_ERR(map);
+		}
+		/*
+		 * Publish before filling: EVFS changes racing with the
+		 * initial sync rewrite whole groups under the group lock,
+		 * so whichever copy lands last is current.
+		 */
+		rcu_assign_pointer(ei->ei_map, map);
+		populate = true;
+	}
+	map->em_users++;
+	mutex_unlock(&ei->ei_map_lock);
+
+	mf->mf_map = map;
+	mf->mf_file = get_file(filp);
+	if (populate) {
+		err = ext4_evfs_map_sync(sb, map);
+		if (err)
+			goto out;
+	}
+
+	mf->mf_ei = ext4_evfs_info_hold(ei);
+	fd = anon_inode_getfd("[ext4-evfs-map]", &ext4_evfs_map_fops, mf,
+			      O_RDONLY | O_CLOEXEC);
+	if (fd >= 0)
+		return fd;
+	ext4_evfs_info_put(ei);
+	err = fd;
+out:
+	ext4_evfs_map_put(ei, map);
+	fput(mf->mf_file);
+	kfree(mf);
+	return err;
+}
+
+/*
+ * Set @len bits of @bm starting at @cur and return how many of them were
+ * already set. Aligned words are handled whole as in mb_set_bits(), with
+ * one popcount per word for the free count.
+ */
+static int ext4_evfs_set_bits(void *bm, int cur, int len)
+{
+	__u32 *addr;
+	int already = 0;
+
+	len = cur + len;
+	while (cur < len) {
+		if ((cur & 31) == 0 && (len - cur) >= 32) {
+			/* fast path: set whole word at once */
+			addr = bm + (cur >> 3);
+			already += hweight32(*addr);
+			*addr = 0xffffffff;
+			cur += 32;
+			continue;
+		}
+		already += !!ext4_test_and_set_bit(cur, bm);
+		cur++;
+	}
+	return already;
+}
+
+/* Return how many of the @len bits of @bm starting at @cur are set */
+static int ext4_evfs_count_bits(const void *bm, int cur, int len)
+{
+	const __u32 *addr;
+	int set = 0;
+
+	len = cur + len;
+	while (cur < len) {
+		if ((cur & 31) == 0 && (len - cur) >= 32) {
+			addr = bm + (cur >> 3);
+			set += hweight32(*addr);
+			cur += 32;
+			continue;
+		}
+		set += !!ext4_test_bit(cur, bm);
+		cur++;
+	}
+	return set;
+}
+
+/* Clear @len bits of @bm starting at @cur and return how many were set */
+static int ext4_evfs_clear_bits(void *bm, int cur, int len)
+{
+	__u32 *addr;
+	int was_set = 0;
+
+	len = cur + len;
+	while (cur < len) {
+		if ((cur & 31) == 0 && (len - cur) >= 32) {
+			/* fast path: clear whole word at once */
+			addr = bm + (cur >> 3);
+			was_set += hweight32(*addr);
+			*addr = 0;
+			cur += 32;
+			continue;
+		}
+		was_set += !!ext4_test_and_clear_bit(cur, bm);
+		cur++;
+	}
+	return was_set;
+}
+
+/*
+ * Copy @nbits bits of @src starting at bit @sbit to @dst starting at bit
+ * @dbit. Both sides use ext4's little-endian bit order, so byte-aligned
+ * runs are a plain memcpy.
+ */
+static void ext4_evfs_copy_bits(void *dst, unsigned int dbit,
+				const void *src, unsigned int sbit,
+				unsigned int nbits)
+{
+	if (!(dbit & 7) && !(sbit & 7)) {
+		unsigned int bytes = nbits >> 3;
+
+		memcpy(dst + (dbit >> 3), src + (sbit >> 3), bytes);
+		dbit += bytes << 3;
+		sbit += bytes << 3;
+		nbits &= 7;
+	}
+	while (nbits--) {
+		if (ext4_test_bit(sbit++, src))
+			ext4_set_bit(dbit, dst);
+		else
+			ext4_clear_bit(dbit, dst);
+		dbit++;
+	}
+}
+
+/*
+ * Blocks claimed through EVFS are remembered per group, so that EVFS only
+ * ever gives back blocks it took and can't free one a real inode owns.
+ * Inodes are tracked the same way, along with which of them were claimed
+ * as directories: each group has a tracker of each EXT4_EVFS_TRACK_* kind,
+ * kept in ei_track and the tracker file under ext4_evfs_track_slot().
+ *
+ * A group's claims start out as a short sorted array of runs, which is
+ * all a group needs while claims are mostly contiguous. Once that array
+ * is full the group switches to a plain bitmap, one bit per cluster or
+ * inode, so the worst case is the size of the group's bitmap. A group whose
+ * claims are all given back returns to runs.
+ *
+ * Trackers are created on a group's first claim, or read back from the
+ * tracker file, and live as long as the EVFS state. Their contents are
+ * only touched under the group lock.
+ */
+#define EXT4_EVFS_TRACK_RUNS	30
+
+static unsigned long ext4_evfs_track_slot(ext4_group_t group, int kind)
+{
+	return (unsigned long)group * EXT4_EVFS_TRACK_KINDS + kind;
+}
+
+struct ext4_evfs_track_run {
+	u32	tr_start;
+	u32	tr_len;
+};
+
+struct ext4_evfs_track {
+	unsigned int		et_count;	/* clusters tracked */
+	unsigned int		et_nr_runs;
+	void			*et_bitmap;	/* bitmap form, or NULL */
+	struct ext4_evfs_track_run et_runs[EXT4_EVFS_TRACK_RUNS];
+};
+
+static void ext4_evfs_track_free(struct ext4_evfs_track *et)
+{
+	if (!et)
+		return;
+	kfree(et->et_bitmap);
+	kfree(et);
+}
+
+static struct ext4_evfs_track_tail *
+ext4_evfs_track_tail(struct super_block *sb, struct buffer_head *bh)
+{
+	return (struct ext4_evfs_track_tail *)(bh->b_data + sb->s_blocksize -
+			sizeof(struct ext4_evfs_track_tail));
+}
+
+static __le32 ext4_evfs_track_csum(struct ext4_evfs_info *ei,
+				   struct buffer_head *bh,
+				   struct buffer_head *bitmap_bh)
+{
+	struct super_block *sb = ei->ei_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_evfs_track_tail *tail = ext4_evfs_track_tail(sb, bh);
+	__le64 dsk_block_nr = cpu_to_le64(bh->b_blocknr);
+	__u32 csum;
+
+	if (!ext4_has_metadata_csum(sb))
+		return 0;
+	csum = ext4_chksum(sbi, ei->ei_track_csum_seed, (__u8 *)&dsk_block_nr,
+			   sizeof(dsk_block_nr));
+	csum = ext4_chksum(sbi, csum, (__u8 *)bh->b_data,
+			   le16_to_cpu(tail->tt_nr_runs) *
+			   sizeof(struct ext4_evfs_track_disk_run));
+	if (bitmap_bh)
+		csum = ext4_chksum(sbi, csum, (__u8 *)bitmap_bh->b_data,
+				   sb->s_blocksize);
+	csum = ext4_chksum(sbi, csum, (__u8 *)tail,
+			   offsetof(struct ext4_evfs_track_tail, tt_checksum));
+	return cpu_to_le32(csum);
+}
+
+/*
+ * Read the tracker in @slot from the tracker file. Returns it, NULL if
+ * nothing is claimed, or an ERR_PTR.
+ */
+static struct ext4_evfs_track *ext4_evfs_track_load(struct ext4_evfs_info *ei,
+						    unsigned long slot)
+{
+	struct inode *inode = ei->ei_track_inode;
+	struct super_block *sb = ei->ei_sb;
+	struct buffer_head *bh, *bitmap_bh = NULL;
+	struct ext4_evfs_track_disk_run *runs;
+	struct ext4_evfs_track_tail *tail;
+	struct ext4_evfs_track *et = NULL;
+	unsigned int i, nr, flags, bits;
+	u32 end = 0;
+	int err = -EFSCORRUPTED;
+
+	if (slot % EXT4_EVFS_TRACK_KINDS == EXT4_EVFS_TRACK_CLUSTERS)
+		bits = EXT4_CLUSTERS_PER_GROUP(sb);
+	else
+		bits = EXT4_INODES_PER_GROUP(sb);
+	bh = ext4_bread(NULL, inode, 2 * slot, 0);
+	if (IS_ERR_OR_NULL(bh))
+		return ERR_CAST(bh);
+
+	tail = ext4_evfs_track_tail(sb, bh);
+	flags = le16_to_cpu(tail->tt_flags);
+	nr = le16_to_cpu(tail->tt_nr_runs);
+	if (le32_to_cpu(tail->tt_magic) != EXT4_EVFS_TRACK_MAGIC ||
+	    flags & ~EXT4_EVFS_TRACK_BITMAP || nr > EXT4_EVFS_TRACK_RUNS ||
+	    (flags & EXT4_EVFS_TRACK_BITMAP && nr))
+		goto corrupted;
+	if (flags & EXT4_EVFS_TRACK_BITMAP) {
+		bitmap_bh = ext4_bread(NULL, inode, 2 * slot + 1, 0);
+		if (IS_ERR(bitmap_bh)) {
+			err = PTR_ERR(bitmap_bh);
+			bitmap_bh = NULL;
+			goto out;
+		}
+		if (!bitmap_bh)
+			goto corrupted;
+	}
+	if (tail->tt_checksum != ext4_evfs_track_csum(ei, bh, bitmap_bh)) {
+		err = -EFSBADCRC;
+		goto corrupted;
+	}
+	err = 0;
+	if (!tail->tt_count)
+		goto out;
+
+	et = kzalloc(sizeof(*et), GFP_NOFS);
+	if (!et) {
+		err = -ENOMEM;
+		goto out;
+	}
+	et->et_count = le32_to_cpu(tail->tt_count);
+	if (bitmap_bh) {
+		et->et_bitmap = kmemdup(bitmap_bh->b_data, sb->s_blocksize,
+					GFP_NOFS);
+		if (!et->et_bitmap)
+			err = -ENOMEM;
+		goto out;
+	}
+
+	runs = (struct ext4_evfs_track_disk_run *)bh->b_data;
+	for (i = 0; i < nr; i++) {
+		et->et_runs[i].tr_start = le32_to_cpu(runs[i].dr_start);
+		et->et_runs[i].tr_len = le32_to_cpu(runs[i].dr_len);
+		// runs are sorted, non-empty and never touch
+		if ((i && et->et_runs[i].tr_start <= end) ||
+		    !et->et_runs[i].tr_len ||
+		    et->et_runs[i].tr_start + et->et_runs[i].tr_len > bits) {
+			err = -EFSCORRUPTED;
+			goto corrupted;
+		}
+		end = et->et_runs[i].tr_start + et->et_runs[i].tr_len;
+	}
+	et->et_nr_runs = nr;
+	goto out;
+
+corrupted:
+	EXT4_ERROR_INODE_ERR(inode, -err,
+			     "bad EVFS tracker block for group %lu",
+			     slot / EXT4_EVFS_TRACK_KINDS);
+out:
+	brelse(bitmap_bh);
+	brelse(bh);
+	if (err) {
+		ext4_evfs_track_free(et);
+		return ERR_PTR(err);
+	}
+	return et;
+}
+
+/*
+ * Look up the tracker in @slot, reading it from disk on first use. With
+ * @create, a slot with nothing claimed gets an empty tracker; without it,
+ * such a slot returns NULL.
+ *
+ * Slots read from disk with nothing claimed are remembered with a value
+ * entry so the tracker file is only read once per slot.
+ */
+static struct ext4_evfs_track *ext4_evfs_track_get(struct ext4_evfs_info *ei,
+						   unsigned long slot,
+						   bool create)
+{
+	struct ext4_evfs_track *et;
+	void *entry;
+	int err = 0;
+
+	entry = xa_load(&ei->ei_track, slot);
+	if (entry && !xa_is_value(entry))
+		return entry;
+	if (!create && (entry || !ei->ei_track_inode))
+		return NULL;
+
+	mutex_lock(&ei->ei_track_lock);
+	entry = xa_load(&ei->ei_track, slot);
+	if (!entry && ei->ei_track_inode) {
+		et = ext4_evfs_track_load(ei, slot);
+		if (IS_ERR(et)) {
+			err = PTR_ERR(et);
+			goto out;
+		}
+		entry = et ?: xa_mk_value(0);
+		err = xa_err(xa_store(&ei->ei_track, slot, entry, GFP_NOFS));
+		if (err) {
+			ext4_evfs_track_free(et);
+			goto out;
+		}
+	}
+	if (create && (!entry || xa_is_value(entry))) {
+		et = kzalloc(sizeof(*et), GFP_NOFS);
+		if (!et) {
+			err = -ENOMEM;
+			goto out;
+		}
+		err = xa_err(xa_store(&ei->ei_track, slot, et, GFP_NOFS));
+		if (err) {
+			kfree(et);
+			goto out;
+		}
+		entry = et;
+	}
+out:
+	mutex_unlock(&ei->ei_track_lock);
+	if (err)
+		return ERR_PTR(err);
+	return xa_is_value(entry) ? NULL : entry;
+}
+
+/*
+ * Could adding @new_runs runs overflow @et's run array? Then a spare
+ * bitmap has to be at hand before the group lock is taken.
+ */
+static bool ext4_evfs_track_need_spare(struct ext4_evfs_track *et,
+				       unsigned int new_runs)
+{
+	return et && !et->et_bitmap &&
+	       et->et_nr_runs + new_runs > EXT4_EVFS_TRACK_RUNS;
+}
+
+/* Index of the first run ending at or after @bit */
+static unsigned int ext4_evfs_track_find(struct ext4_evfs_track *et, u32 bit)
+{
+	unsigned int lo = 0, hi = et->et_nr_runs;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		struct ext4_evfs_track_run *r = &et->et_runs[mid];
+
+		if (r->tr_start + r->tr_len < bit)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Is every bit set in @bm within [start, start + len) tracked? */
+static bool ext4_evfs_track_covers(struct ext4_evfs_track *et, void *bm,
+				   int start, int len)
+{
+	int end = start + len, next;
+	unsigned int i;
+
+	for (;;) {
+		start = ext4_find_next_bit(bm, end, start);
+		if (start >= end)
+			return true;
+		next = ext4_find_next_zero_bit(bm, end, start);
+		if (!et)
+			return false;
+
+		if (et->et_bitmap) {
+			if (ext4_find_next_zero_bit(et->et_bitmap, next,
+						    start) < next)
+				return false;
+		} else {
+			// runs never touch, so a covered run lies in just one
+			i = ext4_evfs_track_find(et, start + 1);
+			if (i == et->et_nr_runs ||
+			    et->et_runs[i].tr_start > start ||
+			    et->et_runs[i].tr_start + et->et_runs[i].tr_len < next)
+				return false;
+		}
+		start = next;
+	}
+}
+
+/* Switch @et to its bitmap form, using the caller's spare bitmap */
+static void ext4_evfs_track_to_bitmap(struct ext4_evfs_track *et,
+				      void **spare, unsigned int size)
+{
+	unsigned int i;
+
+	et->et_bitmap = *spare;
+	*spare = NULL;
+	memset(et->et_bitmap, 0, size);
+	for (i = 0; i < et->et_nr_runs; i++)
+		mb_set_bits(et->et_bitmap, et->et_runs[i].tr_start,
+			    et->et_runs[i].tr_len);
+	et->et_nr_runs = 0;
+}
+
+/* Copy what @et tracks, if anything, into @bm, a bitmap of @size bytes */
+static void ext4_evfs_track_copy(struct ext4_evfs_track *et, void *bm,
+				 unsigned int size)
+{
+	unsigned int i;
+
+	if (et && et->et_bitmap) {
+		memcpy(bm, et->et_bitmap, size);
+		return;
+	}
+	memset(bm, 0, size);
+	for (i = 0; et && i < et->et_nr_runs; i++)
+		mb_set_bits(bm, et->et_runs[i].tr_start, et->et_runs[i].tr_len);
+}
+
+/*
+ * Replace runs [i, j) with the @nr runs in @new, switching to the bitmap
+ * form if they no longer fit. Returns false in that case, with nothing
+ * changed yet.
+ */
+static bool ext4_evfs_track_splice(struct ext4_evfs_track *et,
+				   unsigned int i, unsigned int j,
+				   struct ext4_evfs_track_run *new,
+				   unsigned int nr)
+{
+	if (et->et_nr_runs - (j - i) + nr > EXT4_EVFS_TRACK_RUNS)
+		return false;
+	memmove(&et->et_runs[i + nr], &et->et_runs[j],
+		(et->et_nr_runs - j) * sizeof(*et->et_runs));
+	memcpy(&et->et_runs[i], new, nr * sizeof(*new));
+	et->et_nr_runs += nr - (j - i);
+	return true;
+}
+
+/* Track [start, start + len) */
+static void ext4_evfs_track_add(struct ext4_evfs_track *et, void **spare,
+				unsigned int size, u32 start, u32 len)
+{
+	struct ext4_evfs_track_run new = { start, len };
+	u32 end = start + len, new_end = end, overlap = 0;
+	unsigned int i, j;
+
+	if (!et->et_bitmap) {
+		// merge with every run this one overlaps or touches
+		i = ext4_evfs_track_find(et, start);
+		for (j = i; j < et->et_nr_runs &&
+			    et->et_runs[j].tr_start <= end; j++) {
+			struct ext4_evfs_track_run *r = &et->et_runs[j];
+			u32 r_end = r->tr_start + r->tr_len;
+
+			overlap += min(r_end, end) - max(r->tr_start, start);
+			if (r->tr_start < new.tr_start)
+				new.tr_start = r->tr_start;
+			if (r_end > new_end)
+				new_end = r_end;
+		}
+		new.tr_len = new_end - new.tr_start;
+		if (ext4_evfs_track_splice(et, i, j, &new, 1)) {
+			et->et_count += len - overlap;
+			return;
+		}
+		ext4_evfs_track_to_bitmap(et, spare, size);
+	}
+	et->et_count += len - ext4_evfs_set_bits(et->et_bitmap, start, len);
+}
+
+/* Stop tracking [start, start + len) */
+static void ext4_evfs_track_del(struct ext4_evfs_track *et, void **spare,
+				unsigned int size, u32 start, u32 len)
+{
+	struct ext4_evfs_track_run new[2];
+	u32 end = start + len, removed = 0;
+	unsigned int i, j, nr = 0;
+
+	if (!et->et_bitmap) {
+		i = ext4_evfs_track_find(et, start + 1);
+		for (j = i; j < et->et_nr_runs &&
+			    et->et_runs[j].tr_start < end; j++) {
+			struct ext4_evfs_track_run *r = &et->et_runs[j];
+			u32 r_end = r->tr_start + r->tr_len;
+
+			removed += min(r_end, end) - max(r->tr_start, start);
+			// keep what sticks out on either side
+			if (r->tr_start < start)
+				new[nr++] = (struct ext4_evfs_track_run)
+					{ r->tr_start, start - r->tr_start };
+			if (r_end > end)
+				new[nr++] = (struct ext4_evfs_track_run)
+					{ end, r_end - end };
+		}
+		if (ext4_evfs_track_splice(et, i, j, new, nr)) {
+			et->et_count -= removed;
+			return;
+		}
+		ext4_evfs_track_to_bitmap(et, spare, size);
+	}
+
+	et->et_count -= ext4_evfs_clear_bits(et->et_bitmap, start, len);
+	if (!et->et_count) {
+		// nothing left to track: back to (no) runs
+		if (*spare)
+			kfree(et->et_bitmap);
+		else
+			*spare = et->et_bitmap;
+		et->et_bitmap = NULL;
+	}
+}
+
+static void ext4_evfs_track_destroy(struct ext4_evfs_info *ei)
+{
+	struct ext4_evfs_track *et;
+	unsigned long group;
+
+	xa_for_each(&ei->ei_track, group, et)
+		if (!xa_is_value(et))
+			ext4_evfs_track_free(et);
+	xa_destroy(&ei->ei_track);
+}
+
+/* Write @eg's tracker into its tracker file blocks. */
+static void ext4_evfs_track_store(struct ext4_evfs_info *ei,
+				  struct ext4_evfs_group *eg)
+{
+	struct super_block *sb = ei->ei_sb;
+	struct ext4_evfs_track *et = eg->eg_track;
+	struct buffer_head *bitmap_bh = et->et_bitmap ? eg->eg_track_bitmap_bh
+						      : NULL;
+	struct ext4_evfs_track_tail *tail;
+	struct ext4_evfs_track_disk_run *runs;
+	unsigned int i;
+
+	runs = (struct ext4_evfs_track_disk_run *)eg->eg_track_bh->b_data;
+	for (i = 0; i < et->et_nr_runs; i++) {
+		runs[i].dr_start = cpu_to_le32(et->et_runs[i].tr_start);
+		runs[i].dr_len = cpu_to_le32(et->et_runs[i].tr_len);
+	}
+	if (bitmap_bh)
+		memcpy(bitmap_bh->b_data, et->et_bitmap, sb->s_blocksize);
+
+	tail = ext4_evfs_track_tail(sb, eg->eg_track_bh);
+	tail->tt_magic = cpu_to_le32(EXT4_EVFS_TRACK_MAGIC);
+	tail->tt_flags = cpu_to_le16(bitmap_bh ? EXT4_EVFS_TRACK_BITMAP : 0);
+	tail->tt_nr_runs = cpu_to_le16(et->et_nr_runs);
+	tail->tt_count = cpu_to_le32(et->et_count);
+	tail->tt_checksum = ext4_evfs_track_csum(ei, eg->eg_track_bh,
+						 bitmap_bh);
+	eg->eg_track_bitmap_used = bitmap_bh != NULL;
+}
+
+/* Journal credits for writing one group's tracker, allocation included */
+static int ext4_evfs_track_credits(struct ext4_evfs_info *ei)
+{
+	if (!ei->ei_track_inode)
+		return 0;
+	return 2 + ext4_chunk_trans_blocks(ei->ei_track_inode, 2);
+}
+
+/*
+ * Read tracker file block @lblk for writing under @handle, allocating it
+ * (and growing the file over it) if it's a hole.
+ */
+static int ext4_evfs_track_get_block(handle_t *handle,
+				     struct ext4_evfs_info *ei,
+				     ext4_lblk_t lblk,
+				     struct buffer_head **bhp)
+{
+	struct inode *inode = ei->ei_track_inode;
+	loff_t size = (loff_t)(lblk + 1) << inode->i_blkbits;
+	struct buffer_head *bh;
+	int err;
+
+	bh = ext4_bread(handle, inode, lblk, EXT4_GET_BLOCKS_CREATE);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	err = ext4_journal_get_write_access(handle, ei->ei_sb, bh,
+					    EXT4_JTR_NONE);
+	if (!err && size > EXT4_I(inode)->i_disksize) {
+		mutex_lock(&ei->ei_track_lock);
+		if (size > EXT4_I(inode)->i_disksize) {
+			i_size_write(inode, size);
+			EXT4_I(inode)->i_disksize = size;
+			err = ext4_mark_inode_dirty(handle, inode);
+		}
+		mutex_unlock(&ei->ei_track_lock);
+	}
+	if (err) {
+		brelse(bh);
+		return err;
+	}
+	*bhp = bh;
+	return 0;
+}
+
+/*
+ * Does @eg have everything its tracker can need while the group lock is
+ * held: a spare bitmap if the run array may overflow, and the tracker
+ * file blocks it will be written to?
+ */
+static bool ext4_evfs_track_ready(struct ext4_evfs_info *ei,
+				  struct ext4_evfs_group *eg,
+				  unsigned int new_runs)
+{
+	struct ext4_evfs_track *et = eg->eg_track;
+	bool to_bitmap = ext4_evfs_track_need_spare(et, new_runs);
+
+	if (!et)
+		return true;
+	if (to_bitmap && !eg->eg_track_spare)
+		return false;
+	if (!ei->ei_track_inode)
+		return true;
+	return eg->eg_track_bh &&
+	       (eg->eg_track_bitmap_bh || !(et->et_bitmap || to_bitmap));
+}
+
+/*
+ * Get what ext4_evfs_track_ready() found missing. Runs without the group
+ * lock, so the tracker may change meanwhile; the caller checks again.
+ */
+static int ext4_evfs_track_prepare(handle_t *handle,
+				   struct ext4_evfs_info *ei,
+				   struct ext4_evfs_group *eg,
+				   unsigned int new_runs)
+{
+	struct ext4_evfs_track *et = eg->eg_track;
+	bool to_bitmap = ext4_evfs_track_need_spare(et, new_runs);
+	int err;
+
+	if (to_bitmap && !eg->eg_track_spare) {
+		eg->eg_track_spare = kmalloc(ei->ei_sb->s_blocksize, GFP_NOFS);
+		if (!eg->eg_track_spare)
+			return -ENOMEM;
+	}
+	if (!ei->ei_track_inode)
+		return 0;
+	if (!eg->eg_track_bh) {
+		err = ext4_evfs_track_get_block(handle, ei,
+						2 * eg->eg_track_slot,
+						&eg->eg_track_bh);
+		if (err)
+			return err;
+	}
+	if ((READ_ONCE(et->et_bitmap) || to_bitmap) && !eg->eg_track_bitmap_bh)
+		return ext4_evfs_track_get_block(handle, ei,
+						 2 * eg->eg_track_slot + 1,
+						 &eg->eg_track_bitmap_bh);
+	return 0;
+}
+
+/* Add the tracker blocks @eg stored into to the transaction */
+static int ext4_evfs_track_dirty(handle_t *handle, struct ext4_evfs_info *ei,
+				 struct ext4_evfs_group *eg)
+{
+	int err = 0;
+
+	if (eg->eg_track_bitmap_used)
+		err = ext4_handle_dirty_metadata(handle, ei->ei_track_inode,
+						 eg->eg_track_bitmap_bh);
+	if (!err)
+		err = ext4_handle_dirty_metadata(handle, ei->ei_track_inode,
+						 eg->eg_track_bh);
+	return err;
+}
+
+static void ext4_evfs_track_put(struct ext4_evfs_group *eg)
+{
+	brelse(eg->eg_track_bitmap_bh);
+	brelse(eg->eg_track_bh);
+	kfree(eg->eg_track_spare);
+	eg->eg_track_bitmap_bh = eg->eg_track_bh = NULL;
+	eg->eg_track_spare = NULL;
+}
+
+/*
+ * Create the tracker file in the root directory, through @filp's mount.
+ * EEXIST if the name is taken, in which case a regular file there becomes
+ * the tracker if there wasn't one.
+ */
+static int ext4_evfs_track_create(struct ext4_evfs_info *ei,
+				  struct file *filp)
+{
+	struct super_block *sb = ei->ei_sb;
+	struct inode *dir = d_inode(sb->s_root);
+	struct dentry *dentry;
+	int err = -EEXIST;
+
+	mutex_lock(&ext4_evfs_setup_lock);
+	if (ei->ei_track_inode)
+		goto out;
+
+	inode_lock_nested(dir, I_MUTEX_PARENT);
+	dentry = lookup_one_len(EXT4_EVFS_TRACK_NAME, sb->s_root,
+				strlen(EXT4_EVFS_TRACK_NAME));
+	if (IS_ERR(dentry)) {
+		err = PTR_ERR(dentry);
+		goto out_unlock;
+	}
+	if (d_really_is_positive(dentry))
+		err = -EEXIST;
+	else
+		err = vfs_create(mnt_idmap(filp->f_path.mnt), dir, dentry,
+				 S_IFREG | 0600, true);
+	if ((!err || err == -EEXIST) && d_is_reg(dentry))
+		ext4_evfs_track_set_inode(ei, igrab(d_inode(dentry)));
+	dput(dentry);
+out_unlock:
+	inode_unlock(dir);
+out:
+	mutex_unlock(&ext4_evfs_setup_lock);
+	return err;
+}
+
+/*
+ * mnt_want_write_file() for an EVFS change, which also makes sure there
+ * is a tracker file for it to record its claims in. Creating it is the
+ * first change on a filesystem, so trackers never exist only in memory
+ * and the EVFS state can be dropped whenever nothing is using it.
+ */
+static int ext4_evfs_want_write(struct file *filp)
+{
+	struct ext4_evfs_info *ei = ext4_evfs_info(file_inode(filp)->i_sb);
+	int err;
+
+	err = mnt_want_write_file(filp);
+	if (err || smp_load_acquire(&ei->ei_track_inode))
+		return err;
+	err = ext4_evfs_track_create(ei, filp);
+	// lost a race to create it
+	if (err == -EEXIST && smp_load_acquire(&ei->ei_track_inode))
+		err = 0;
+	if (err)
+		mnt_drop_write_file(filp);
+	return err;
+}
+
+/*
+ * Create the tracker file ahead of the first change, which would
+ * otherwise do it. EEXIST if there already is one.
+ */
+static long ext4_evfs_ioctl_create_tracker(struct file *filp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_info *ei;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	ei = ext4_evfs_info(sb);
+	err = mnt_want_write_file(filp);
+	if (err)
+		return err;
+	err = ext4_evfs_track_create(ei, filp);
+	mnt_drop_write_file(filp);
+	return err;
+}
+
+/*
+ * /proc/fs/ext4/<dev>/evfs_groups, one line per group as for mb_groups:
+ * EVFS operations applied to it, clusters EVFS has claimed in it, when it
+ * was last changed (0 if never) and whether its block bitmap is cached.
+ * Trackers not yet in memory are read as the listing gets to them.
+ */
+static void *ext4_evfs_seq_groups_start(struct seq_file *seq, loff_t *pos)
+{
+	struct ext4_evfs_info *ei = pde_data(file_inode(seq->file));
+
+	if (*pos < 0 || *pos >= ext4_get_groups_count(ei->ei_sb))
+		return NULL;
+	return (void *)((unsigned long)*pos + 1);
+}
+
+static void *ext4_evfs_seq_groups_next(struct seq_file *seq, void *v,
+				       loff_t *pos)
+{
+	++*pos;
+	return ext4_evfs_seq_groups_start(seq, pos);
+}
+
+static int ext4_evfs_seq_groups_show(struct seq_file *seq, void *v)
+{
+	struct ext4_evfs_info *ei = pde_data(file_inode(seq->file));
+	struct super_block *sb = ei->ei_sb;
+	ext4_group_t group = (ext4_group_t)((unsigned long)v) - 1;
+	struct ext4_evfs_group_stats *gs = xa_load(&ei->ei_groups, group);
+	struct ext4_group_desc *gdp;
+	struct ext4_evfs_track *et;
+	struct buffer_head *bh;
+	bool cached = false;
+
+	if (group == 0)
+		seq_puts(seq, "#group: ops claimed last_op cached\n");
+
+	gdp = ext4_get_group_desc(sb, group, NULL);
+	if (gdp) {
+		bh = sb_find_get_block(sb, ext4_block_bitmap(sb, gdp));
+		cached = bh && buffer_uptodate(bh);
+		brelse(bh);
+	}
+
+	seq_printf(seq, "#%-5u: %-8llu ", group,
+		   gs ? READ_ONCE(gs->gs_ops) : 0);
+	et = ext4_evfs_track_get(ei, ext4_evfs_track_slot(group,
+					EXT4_EVFS_TRACK_CLUSTERS), false);
+	if (IS_ERR(et))
+		seq_puts(seq, "?        ");
+	else
+		seq_printf(seq, "%-8u ", et ? READ_ONCE(et->et_count) : 0);
+	seq_printf(seq, "%-10lld %d\n", gs ? (s64)READ_ONCE(gs->gs_last) : 0LL,
+		   cached);
+	return 0;
+}
+
+static void ext4_evfs_seq_groups_stop(struct seq_file *seq, void *v)
+{
+}
+
+static const struct seq_operations ext4_evfs_seq_groups_ops = {
+	.start	= ext4_evfs_seq_groups_start,
+	.next	= ext4_evfs_seq_groups_next,
+	.stop	= ext4_evfs_seq_groups_stop,
+	.show	= ext4_evfs_seq_groups_show,
+};
+
+/*
+ * Drop a reference to the filesystem's EVFS state, freeing it with the
+ * last one: trackers, buddy and map state, the tracker inode's reference
+ * and the async workqueue. Everything that could still be using any of
+ * it held a reference, and the tracker is on disk, so there is nothing
+ * to write back.
+ */
+static void ext4_evfs_info_put(struct ext4_evfs_info *ei)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ei->ei_sb);
+	struct ext4_evfs_group_stats *gs;
+	unsigned long idx;
+
+	if (!refcount_dec_and_mutex_lock(&ei->ei_ref, &ext4_evfs_setup_lock))
+		return;
+	RCU_INIT_POINTER(sbi->s_evfs_info, NULL);
+	// removal waits for readers of either file; new state recreates them
+	if (sbi->s_proc) {
+		remove_proc_entry("evfs_stats", sbi->s_proc);
+		remove_proc_entry("evfs_groups", sbi->s_proc);
+	}
+	mutex_unlock(&ext4_evfs_setup_lock);
+
+	// map fds and queued jobs hold references, so both are gone
+	WARN_ON_ONCE(rcu_access_pointer(ei->ei_map));
+	if (ei->ei_async_wq)
+		destroy_workqueue(ei->ei_async_wq);
+	ext4_evfs_track_destroy(ei);
+	xa_for_each(&ei->ei_groups, idx, gs)
+		kfree(gs);
+	xa_destroy(&ei->ei_groups);
+	iput(ei->ei_track_inode);
+	free_percpu(ei->ei_stats);
+	// ext4_evfs_info_get() may still be looking at it
+	kfree_rcu(ei, ei_rcu);
+}
+
+/*
+ * mballoc allocates from an in-memory buddy of each group, kept in the
+ * s_buddy_cache inode as two blocks per group: the bitmap as the
+ * allocator sees it (on-disk bits plus preallocations) followed by the
+ * higher orders. Rather than patch it with a copy of mballoc's buddy
+ * code, EVFS marks the cached pages of a group it changes out of date,
+ * and ext4_mb_load_buddy() regenerates them from the on-disk bitmap and
+ * the preallocations, as it would had they been reclaimed. Only bb_free
+ * is kept up to date meanwhile, as the rebuild checks the bitmap against
+ * it.
+ *
+ * An allocation keeps the pages pinned from finding its blocks until
+ * they are marked on disk (see ext4_mb_use_best_found()), and a rebuild
+ * in between would hand them out again. So the pages are only marked
+ * out of date while nobody else holds them; if anyone does, the group's
+ * entries fail with -EBUSY.
+ */
+
+/*
+ * Lock the buddy cache pages of @group, where cached, so that
+ * ext4_mb_init_group() can't be (re)generating them meanwhile. The lock
+ * order, page then group lock, is the one mballoc uses.
+ */
+static void ext4_evfs_buddy_lock_pages(struct super_block *sb,
+				       ext4_group_t group,
+				       struct ext4_buddy *e4b)
+{
+	struct address_space *mapping = EXT4_SB(sb)->s_buddy_cache->i_mapping;
+	int blocks_per_page = PAGE_SIZE / sb->s_blocksize;
+	int block = group * 2;
+
+	memset(e4b, 0, sizeof(*e4b));
+	e4b->bd_sb = sb;
+	e4b->bd_group = group;
+	e4b->bd_blkbits = sb->s_blocksize_bits;
+	e4b->bd_info = ext4_get_group_info(sb, group);
+
+	e4b->bd_bitmap_page = find_lock_page(mapping, block / blocks_per_page);
+	// both blocks live in the same page unless pages hold one block
+	if (blocks_per_page >= 2)
+		e4b->bd_buddy_page = e4b->bd_bitmap_page;
+	else
+		e4b->bd_buddy_page = find_lock_page(mapping, block + 1);
+}
+
+static void ext4_evfs_buddy_unlock_pages(struct ext4_buddy *e4b)
+{
+	if (e4b->bd_buddy_page && e4b->bd_buddy_page != e4b->bd_bitmap_page) {
+		unlock_page(e4b->bd_buddy_page);
+		put_page(e4b->bd_buddy_page);
+	}
+	if (e4b->bd_bitmap_page) {
+		unlock_page(e4b->bd_bitmap_page);
+		put_page(e4b->bd_bitmap_page);
+	}
+	e4b->bd_bitmap_page = e4b->bd_buddy_page = NULL;
+}
+
+/*
+ * Point bd_bitmap, under the group lock, at mballoc's bitmap of the
+ * group if it is cached and current, for ext4_evfs_buddy_busy().
+ */
+static void ext4_evfs_buddy_attach(struct ext4_evfs_group *eg)
+{
+	struct ext4_buddy *e4b = &eg->eg_buddy;
+	struct super_block *sb = e4b->bd_sb;
+	int blocks_per_page = PAGE_SIZE / sb->s_blocksize;
+	int block = e4b->bd_group * 2;
+
+	e4b->bd_bitmap = NULL;
+	if (!e4b->bd_info || EXT4_MB_GRP_NEED_INIT(e4b->bd_info) ||
+	    EXT4_MB_GRP_BBITMAP_CORRUPT(e4b->bd_info))
+		return;
+	if (e4b->bd_bitmap_page && PageUptodate(e4b->bd_bitmap_page))
+		e4b->bd_bitmap = page_address(e4b->bd_bitmap_page) +
+			(block % blocks_per_page) * sb->s_blocksize;
+}
+
+/*
+ * Mark the group's cached buddy pages out of date before its bitmap is
+ * changed, or fail with -EBUSY if anyone else holds them. The flag is
+ * cleared before the page count is looked at, and ext4_mb_load_buddy()
+ * takes its reference before it tests the flag: either it sees the page
+ * out of date and waits for our page lock to regenerate it, or we see
+ * its reference.
+ */
+static int ext4_evfs_buddy_invalidate(struct ext4_evfs_group *eg)
+{
+	struct ext4_buddy *e4b = &eg->eg_buddy;
+	struct page *pages[2] = { e4b->bd_bitmap_page, e4b->bd_buddy_page };
+	int i, nr = pages[1] == pages[0] ? 1 : 2;
+	bool busy = false;
+
+	// a group mballoc hasn't loaded is generated on first use anyway
+	if (!e4b->bd_info || EXT4_MB_GRP_NEED_INIT(e4b->bd_info))
+		return 0;
+	for (i = 0; i < nr; i++) {
+		if (pages[i] && PageUptodate(pages[i])) {
+			ClearPageUptodate(pages[i]);
+			eg->eg_buddy_cleared |= 1 << i;
+		}
+	}
+	smp_mb();
+	for (i = 0; i < nr; i++) {
+		// the page cache's reference and ours
+		if ((eg->eg_buddy_cleared & (1 << i)) &&
+		    page_count(pages[i]) > 2)
+			busy = true;
+	}
+	if (!busy)
+		return 0;
+	for (i = 0; i < nr; i++)
+		if (eg->eg_buddy_cleared & (1 << i))
+			SetPageUptodate(pages[i]);
+	eg->eg_buddy_cleared = 0;
+	return -EBUSY;
+}
+
+/* Settle the group's mballoc state once all its entries are applied */
+static void ext4_evfs_buddy_finish(struct ext4_evfs_group *eg)
+{
+	struct ext4_group_info *grp = eg->eg_buddy.bd_info;
+
+	/*
+	 * Pages left out of date for a group that didn't change are
+	 * rebuilt for nothing, but may be shared with one that did.
+	 */
+	if (!grp || !eg->eg_changed)
+		return;
+	grp->bb_free += eg->eg_free_delta;
+	// and the allocator's other summaries are redone with the buddy
+	if (eg->eg_buddy_cleared)
+		set_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &grp->bb_state);
+}
+
+/* How far bitmap readahead has got through a sorted entry array */
+struct ext4_evfs_ra {
+	u32		ra_next;	/* first entry not yet read ahead */
+	unsigned int	ra_groups;	/* groups read ahead, not yet used */
+};
+
+/*
+ * Start reading the bitmaps of the group about to be worked on and the
+ * ones after it, up to EXT4_EVFS_READAHEAD_GROUPS of them. Topped up only
+ * once half have been used, so submissions go out in plugged batches.
+ * ext4_read_block_bitmap() then only waits for a read already in flight.
+ *
+ * Call before each group and drop ra_groups once the group is done.
+ */
+static void ext4_evfs_readahead(struct super_block *sb,
+				struct ext4_evfs_ra *ra,
+				struct ext4_evfs_entry *ents, u32 count)
+{
+	struct blk_plug plug;
+	ext4_group_t group;
+
+	if (ra->ra_groups > EXT4_EVFS_READAHEAD_GROUPS / 2 ||
+	    ra->ra_next >= count)
+		return;
+
+	blk_start_plug(&plug);
+	while (ra->ra_next < count &&
+	       ra->ra_groups < EXT4_EVFS_READAHEAD_GROUPS) {
+		group = ents[ra->ra_next].ee_group;
+		ext4_evfs_read_bitmap_ahead(sb, group);
+		ra->ra_groups++;
+		while (ra->ra_next < count &&
+		       ents[ra->ra_next].ee_group == group)
+			ra->ra_next++;
+	}
+	blk_finish_plug(&plug);
+}
+
+/*
+ * Without its seed crc32c is linear, so XORing pattern D into a bitmap
+ * changes its checksum by crc32c(0, D). Setting or clearing every bit of
+ * [@start, @end) XORs in exactly those bits; return their contribution,
+ * hashing only the bytes they cover and shifting over the zeros after
+ * them in O(log n) rather than hashing the rest of the block.
+ */
+static u32 ext4_evfs_csum_delta(struct super_block *sb, ext4_grpblk_t start,
+				ext4_grpblk_t end)
+{
+	static const u8 ones[64] = { [0 ... 63] = 0xff };
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int size = EXT4_CLUSTERS_PER_GROUP(sb) / 8;
+	unsigned int first = start / 8, last = (end - 1) / 8, n;
+	u8 head = 0xff << (start % 8), tail = 0xff >> (7 - (end - 1) % 8);
+	u32 crc;
+
+	if (first == last) {
+		head &= tail;
+		return __crc32c_le_shift(ext4_chksum(sbi, 0, &head, 1),
+					 size - last - 1);
+	}
+	crc = ext4_chksum(sbi, 0, &head, 1);
+	for (first++; first < last; first += n) {
+		n = min_t(unsigned int, last - first, sizeof(ones));
+		crc = ext4_chksum(sbi, crc, ones, n);
+	}
+	crc = ext4_chksum(sbi, crc, &tail, 1);
+	return __crc32c_le_shift(crc, size - last - 1);
+}
+
+/*
+ * Fold the accumulated change into the group's bitmap checksum. With
+ * CONFIG_EXT4_DEBUG the result is checked against a full recompute.
+ */
+static void ext4_evfs_bitmap_csum_update(struct super_block *sb,
+					 struct ext4_evfs_group *eg)
+{
+	struct ext4_group_desc *gdp = eg->eg_gdp;
+	bool hi = EXT4_DESC_SIZE(sb) >= EXT4_BG_BLOCK_BITMAP_CSUM_HI_END;
+	u32 csum;
+
+	if (!ext4_has_metadata_csum(sb))
+		return;
+	if (eg->eg_csum_full) {
+		ext4_block_bitmap_csum_set(sb, gdp, eg->eg_bitmap_bh);
+		return;
+	}
+	if (!eg->eg_csum_delta)
+		return;
+
+	// only the low half is kept with 32-byte descriptors; XOR doesn't mind
+	csum = le16_to_cpu(gdp->bg_block_bitmap_csum_lo);
+	if (hi)
+		csum |= (u32)le16_to_cpu(gdp->bg_block_bitmap_csum_hi) << 16;
+	csum ^= eg->eg_csum_delta;
+	gdp->bg_block_bitmap_csum_lo = cpu_to_le16(csum & 0xFFFF);
+	if (hi)
+		gdp->bg_block_bitmap_csum_hi = cpu_to_le16(csum >> 16);
+
+#ifdef CONFIG_EXT4_DEBUG
+	if (!ext4_block_bitmap_csum_verify(sb, gdp, eg->eg_bitmap_bh)) {
+		WARN_ONCE(1, "EXT4-fs: EVFS bitmap checksum of group %u drifted",
+			  eg->eg_group);
+		ext4_block_bitmap_csum_set(sb, gdp, eg->eg_bitmap_bh);
+	}
+#endif
+}
+
+/* Drop what ext4_evfs_group_read() got */
+static void ext4_evfs_group_release(struct ext4_evfs_group *eg)
+{
+	ext4_evfs_track_put(eg);
+	brelse(eg->eg_bitmap_bh);
+	eg->eg_bitmap_bh = NULL;
+}
+
+/*
+ * Read a group's block bitmap and take journal write access to it and its
+ * descriptor block: what ext4_evfs_group_begin() does before it locks the
+ * group. @claim creates the group's tracker if it has none yet. Undone by
+ * ext4_evfs_group_release().
+ */
+static int ext4_evfs_group_read(handle_t *handle, struct super_block *sb,
+				struct ext4_evfs_info *ei, ext4_group_t group,
+				bool claim, struct ext4_evfs_group *eg)
+{
+	u64 start;
+	int err;
+
+	memset(eg, 0, sizeof(*eg));
+	eg->eg_group = group;
+	eg->eg_track_slot = ext4_evfs_track_slot(group,
+						 EXT4_EVFS_TRACK_CLUSTERS);
+	eg->eg_stats = ext4_evfs_group_stats(ei, group);
+
+	eg->eg_track = ext4_evfs_track_get(ei, eg->eg_track_slot, claim);
+	if (IS_ERR(eg->eg_track))
+		return PTR_ERR(eg->eg_track);
+
+	start = local_clock();
+	eg->eg_bitmap_bh = ext4_read_block_bitmap(sb, group);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_READ_BITMAP, start);
+	trace_ext4_evfs_read_bitmap(sb, group,
+				    PTR_ERR_OR_ZERO(eg->eg_bitmap_bh));
+	if (IS_ERR(eg->eg_bitmap_bh)) {
+		err = PTR_ERR(eg->eg_bitmap_bh);
+		eg->eg_bitmap_bh = NULL;
+		goto out;
+	}
+
+	eg->eg_gdp = ext4_get_group_desc(sb, group, &eg->eg_gdp_bh);
+	if (!eg->eg_gdp) {
+		err = -EIO;
+		goto out;
+	}
+
+	start = local_clock();
+	err = ext4_journal_get_write_access(handle, sb, eg->eg_bitmap_bh,
+					    EXT4_JTR_NONE);
+	if (!err)
+		err = ext4_journal_get_write_access(handle, sb, eg->eg_gdp_bh,
+						    EXT4_JTR_NONE);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_WRITE_ACCESS, start);
+	trace_ext4_evfs_write_access(sb, group, err);
+	if (!err)
+		return 0;
+out:
+	ext4_evfs_group_release(eg);
+	return err;
+}
+
+/*
+ * Make ready to change a group whose lock the caller has just taken:
+ * see what mballoc has cached of it, mark that out of date, and note the
+ * operation. -EBUSY if mballoc is using it.
+ */
+static int ext4_evfs_group_lock_ready(struct ext4_evfs_group *eg)
+{
+	int err;
+
+	ext4_evfs_buddy_attach(eg);
+	err = ext4_evfs_buddy_invalidate(eg);
+	if (!err)
+		ext4_evfs_group_stats_note(eg->eg_stats);
+	return err;
+}
+
+/*
+ * An uninitialised group's bitmap was synthesised on read. Once we change
+ * it, the descriptor has to describe it for real. Under the group lock,
+ * once nothing can stop the change from going ahead.
+ */
+static void ext4_evfs_group_init_desc(struct super_block *sb,
+				      struct ext4_evfs_group *eg)
+{
+	if (ext4_has_group_desc_csum(sb) &&
+	    (eg->eg_gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+		eg->eg_gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+		ext4_free_group_clusters_set(sb, eg->eg_gdp,
+			ext4_free_clusters_after_init(sb, eg->eg_group,
+						      eg->eg_gdp));
+		// and there's no stored checksum to build on
+		eg->eg_csum_full = true;
+	}
+}
+
+/*
+ * Read a group's block bitmap, take journal write access to it and its
+ * descriptor block, and lock the group against mballoc. On success the
+ * group lock is held until ext4_evfs_group_end().
+ *
+ * @claim creates the group's tracker if it has none yet; @new_runs bounds
+ * the number of runs the operation may add to it. Whatever the tracker
+ * may need under the group lock, including its tracker file blocks, is
+ * got beforehand.
+ */
+static int ext4_evfs_group_begin(handle_t *handle, struct super_block *sb,
+				 struct ext4_evfs_info *ei, ext4_group_t group,
+				 bool claim, unsigned int new_runs,
+				 struct ext4_evfs_group *eg)
+{
+	int err;
+
+	err = ext4_evfs_group_read(handle, sb, ei, group, claim, eg);
+	if (err)
+		return err;
+
+	for (;;) {
+		ext4_evfs_buddy_lock_pages(sb, group, &eg->eg_buddy);
+		ext4_lock_group(sb, group);
+		if (ext4_evfs_track_ready(ei, eg, new_runs))
+			break;
+		// can't allocate or read blocks under the group lock
+		ext4_unlock_group(sb, group);
+		ext4_evfs_buddy_unlock_pages(&eg->eg_buddy);
+		err = ext4_evfs_track_prepare(handle, ei, eg, new_runs);
+		if (err)
+			goto out;
+	}
+	err = ext4_evfs_group_lock_ready(eg);
+	if (err) {
+		ext4_unlock_group(sb, group);
+		ext4_evfs_buddy_unlock_pages(&eg->eg_buddy);
+		goto out;
+	}
+	ext4_evfs_group_init_desc(sb, eg);
+	return 0;
+
+out:
+	ext4_evfs_group_release(eg);
+	return err;
+}
+
+/*
+ * The part of ext4_evfs_group_end() under the group lock: fold the free
+ * count change into the descriptor and mballoc, checksum the bitmap and
+ * descriptor, and update the map and the in-memory tracker.
+ */
+static void ext4_evfs_group_settle(struct super_block *sb,
+				   struct ext4_evfs_info *ei,
+				   struct ext4_evfs_group *eg)
+{
+	if (eg->eg_free_delta)
+		ext4_free_group_clusters_set(sb, eg->eg_gdp,
+			ext4_free_group_clusters(sb, eg->eg_gdp) +
+			eg->eg_free_delta);
+	ext4_evfs_buddy_finish(eg);
+
+	ext4_evfs_bitmap_csum_update(sb, eg);
+	/*
+	 * A descriptor is at most 64 bytes: hashing it beats any shifting.
+	 * It can't be left to a commit-time trigger either: that would only
+	 * checksum the frozen copy, and reading a BLOCK_UNINIT group's
+	 * bitmap verifies the live descriptor.
+	 */
+	ext4_group_desc_csum_set(sb, eg->eg_group, eg->eg_gdp);
+	if (eg->eg_changed)
+		ext4_evfs_map_update(ei, eg->eg_group,
+				     eg->eg_bitmap_bh->b_data, eg->eg_first,
+				     eg->eg_last);
+	if (eg->eg_track_dirty && ei->ei_track_inode)
+		ext4_evfs_track_store(ei, eg);
+}
+
+/*
+ * The part of ext4_evfs_group_end() after the group lock is dropped: the
+ * superblock counters, and adding the blocks to the transaction. Drops
+ * the references taken by ext4_evfs_group_read().
+ */
+static int ext4_evfs_group_dirty(handle_t *handle, struct super_block *sb,
+				 struct ext4_evfs_info *ei,
+				 struct ext4_evfs_group *eg)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	u64 start;
+	int err;
+
+	/*
+	write access is not needed for superblock. percpu() are atomic in-mem updates
+	*/
+	if (eg->eg_free_delta)
+		percpu_counter_add(&sbi->s_freeclusters_counter,
+				   eg->eg_free_delta);
+	// the set bits are now out of the free count; drop their claim
+	if (eg->eg_claimed)
+		percpu_counter_sub(&sbi->s_dirtyclusters_counter,
+				   eg->eg_claimed);
+
+	start = local_clock();
+	err = ext4_handle_dirty_metadata(handle, NULL, eg->eg_bitmap_bh);
+	if (!err)
+		err = ext4_handle_dirty_metadata(handle, NULL, eg->eg_gdp_bh);
+	if (!err && eg->eg_track_dirty && ei->ei_track_inode)
+		err = ext4_evfs_track_dirty(handle, ei, eg);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_DIRTY, start);
+	ext4_evfs_stat_bits(ei, eg->eg_changed, eg->eg_free_delta);
+	trace_ext4_evfs_dirty_metadata(sb, eg->eg_group, err);
+
+	ext4_evfs_group_release(eg);
+	return err;
+}
+
+/*
+ * Fold the group's free count change into the descriptor, mballoc and
+ * the superblock counter, checksum the bitmap and descriptor, write out
+ * the tracker, unlock the group and add the blocks to the transaction.
+ * Drops the references taken by ext4_evfs_group_begin().
+ */
+static int ext4_evfs_group_end(handle_t *handle, struct super_block *sb,
+			       struct ext4_evfs_info *ei,
+			       struct ext4_evfs_group *eg)
+{
+	ext4_evfs_group_settle(sb, ei, eg);
+	ext4_unlock_group(sb, eg->eg_group);
+	ext4_evfs_buddy_unlock_pages(&eg->eg_buddy);
+	return ext4_evfs_group_dirty(handle, sb, ei, eg);
+}
+
+/*
+ * Hand each run of bits that @ent is about to change on disk to the
+ * tracker.
+ */
+static void ext4_evfs_apply_runs(struct super_block *sb,
+				 struct ext4_evfs_group *eg, bool set,
+				 struct ext4_evfs_entry *ent)
+{
+	void *bm = eg->eg_bitmap_bh->b_data;
+	int cur = ent->ee_offset, end = ent->ee_offset + ent->ee_len;
+	int next;
+
+	for (; cur < end; cur = next) {
+		if (set) {
+			cur = ext4_find_next_zero_bit(bm, end, cur);
+			next = ext4_find_next_bit(bm, end, cur);
+		} else {
+			cur = ext4_find_next_bit(bm, end, cur);
+			next = ext4_find_next_zero_bit(bm, end, cur);
+		}
+		if (cur >= end)
+			break;
+
+		if (set)
+			ext4_evfs_track_add(eg->eg_track, &eg->eg_track_spare,
+					    sb->s_blocksize, cur, next - cur);
+		else
+			ext4_evfs_track_del(eg->eg_track, &eg->eg_track_spare,
+					    sb->s_blocksize, cur, next - cur);
+		eg->eg_track_dirty = true;
+		if (ext4_has_metadata_csum(sb) && !eg->eg_csum_full) {
+			if (++eg->eg_csum_runs > EXT4_EVFS_CSUM_DELTA_RUNS)
+				eg->eg_csum_full = true;
+			else
+				eg->eg_csum_delta ^=
+					ext4_evfs_csum_delta(sb, cur, next);
+		}
+		if (!eg->eg_last || cur < eg->eg_first)
+			eg->eg_first = cur;
+		eg->eg_last = max(eg->eg_last, next);
+	}
+}
+
+/*
+ * Is any bit of @ent free on disk but in use in mballoc's bitmap? Such a
+ * block is preallocated, or being allocated right now: mb_mark_used()
+ * marks the buddy before ext4_mb_mark_diskspace_used() gets to the disk.
+ * Without the buddy cached nothing can be in flight.
+ */
+static bool ext4_evfs_buddy_busy(struct ext4_evfs_group *eg,
+				 struct ext4_evfs_entry *ent)
+{
+	void *bm = eg->eg_bitmap_bh->b_data, *mb = eg->eg_buddy.bd_bitmap;
+	int cur = ent->ee_offset, end = ent->ee_offset + ent->ee_len;
+	int next;
+
+	if (!mb)
+		return false;
+	for (; cur < end; cur = next) {
+		cur = ext4_find_next_zero_bit(bm, end, cur);
+		if (cur >= end)
+			break;
+		next = ext4_find_next_bit(bm, end, cur);
+		if (ext4_find_next_bit(mb, next, cur) < next)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Apply the request's mode to one entry's bits, keeping the tracker in
+ * step, and account the change in free clusters.
+ * Returns the new state of the entry's bits, or without changing
+ * anything -EPERM if the entry would clear a block EVFS didn't claim,
+ * -EBUSY if it would set one mballoc is handing out (which must never be
+ * tracked as an EVFS claim), and -ENOSPC if the clusters it would set
+ * can't be claimed. Clusters the caller claimed in rq_reserved are used
+ * up first.
+ */
+static int ext4_evfs_apply(struct super_block *sb, struct ext4_evfs_req *req,
+			   struct ext4_evfs_group *eg,
+			   struct ext4_evfs_entry *ent)
+{
+	void *bm = eg->eg_bitmap_bh->b_data;
+	int was_set;	// how many bits were set BEFORE the change
+	int state, claim = 0, reserved;
+	bool set;
+
+	if (req->rq_mode == EXT4_EVFS_FLIP)
+		set = !ext4_test_bit(ent->ee_offset, bm);
+	else
+		set = req->rq_mode == EXT4_EVFS_SET;
+	if (!set && !ext4_evfs_track_covers(eg->eg_track, bm, ent->ee_offset,
+					    ent->ee_len)) {
+		trace_ext4_evfs_apply(sb, ent->ee_block, ent->ee_group,
+				      ent->ee_offset, ent->ee_len, -1, -EPERM);
+		return -EPERM;
+	}
+	// only blocks free to both disk and mballoc may become EVFS claims
+	if (set && ext4_evfs_buddy_busy(eg, ent)) {
+		trace_ext4_evfs_apply(sb, ent->ee_block, ent->ee_group,
+				      ent->ee_offset, ent->ee_len, -1, -EBUSY);
+		return -EBUSY;
+	}
+
+	/*
+	 * Set bits come out of the free count like any allocation, so they
+	 * may not eat into delalloc reservations or the reserved blocks.
+	 * ext4_claim_free_clusters() is fine under a spinlock; delalloc
+	 * calls it under i_block_reservation_lock.
+	 */
+	if (set)
+		claim = req->rq_mode == EXT4_EVFS_FLIP ? 1 : ent->ee_len -
+			ext4_evfs_count_bits(bm, ent->ee_offset, ent->ee_len);
+	reserved = min_t(u64, claim, req->rq_reserved);
+	if (claim > reserved &&
+	    ext4_claim_free_clusters(EXT4_SB(sb), claim - reserved, 0)) {
+		trace_ext4_evfs_apply(sb, ent->ee_block, ent->ee_group,
+				      ent->ee_offset, ent->ee_len, -1, -ENOSPC);
+		return -ENOSPC;
+	}
+	req->rq_reserved -= reserved;
+	eg->eg_claimed += claim;
+
+	if (req->rq_prior)
+		ext4_evfs_copy_bits(req->rq_prior, ent->ee_idx, bm,
+				    ent->ee_offset, ent->ee_len);
+	ext4_evfs_apply_runs(sb, eg, set, ent);
+
+	switch (req->rq_mode) {
+	case EXT4_EVFS_SET:
+		was_set = ext4_evfs_set_bits(bm, ent->ee_offset, ent->ee_len);
+		eg->eg_free_delta -= ent->ee_len - was_set;
+		eg->eg_changed += ent->ee_len - was_set;
+		state = 1;
+		break;
+	case EXT4_EVFS_CLEAR:
+		was_set = ext4_evfs_clear_bits(bm, ent->ee_offset, ent->ee_len);
+		eg->eg_free_delta += was_set;
+		eg->eg_changed += was_set;
+		state = 0;
+		break;
+	default:
+		// flip: entries are always a single bit
+		was_set = ext4_test_bit(ent->ee_offset, bm);
+		if (was_set) {
+			ext4_clear_bit(ent->ee_offset, bm);
+			eg->eg_free_delta++;
+		} else {
+			ext4_set_bit(ent->ee_offset, bm);
+			eg->eg_free_delta--;
+		}
+		eg->eg_changed++;
+		state = !was_set;
+		break;
+	}
+
+	trace_ext4_evfs_apply(sb, ent->ee_block, ent->ee_group, ent->ee_offset,
+			      ent->ee_len, was_set, state);
+	return state;
+}
+
+/*
+ * Free-cluster change not yet added to a flex group's counter. Entries
+ * are sorted, so the groups of one flex group are visited back to back
+ * and its shared counter is updated once rather than once per group.
+ */
+struct ext4_evfs_flex {
+	ext4_group_t	ef_flex;
+	s64		ef_delta;
+};
+
+static void ext4_evfs_flex_flush(struct super_block *sb,
+				 struct ext4_evfs_flex *ef)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (!ef->ef_delta)
+		return;
+	atomic64_add(ef->ef_delta,
+		     &sbi_array_rcu_deref(sbi, s_flex_groups,
+					  ef->ef_flex)->free_clusters);
+	ef->ef_delta = 0;
+}
+
+static void ext4_evfs_flex_add(struct super_block *sb,
+			       struct ext4_evfs_flex *ef,
+			       ext4_group_t group, int delta)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t flex;
+
+	// s_flex_groups only exists with a non-zero s_log_groups_per_flex
+	if (!sbi->s_log_groups_per_flex || !delta)
+		return;
+	flex = ext4_flex_group(sbi, group);
+	if (flex != ef->ef_flex) {
+		ext4_evfs_flex_flush(sb, ef);
+		ef->ef_flex = flex;
+	}
+	ef->ef_delta += delta;
+}
+
+/*
+ * Largest reservation one EVFS handle takes, so a big operation leaves
+ * most of the running transaction to other writers instead of waiting
+ * for a transaction of its own.
+ */
+static int ext4_evfs_max_credits(struct super_block *sb)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+
+	if (!journal)
+		return INT_MAX;
+	return max(journal->j_max_transaction_buffers / 4, 1);
+}
+
+/*
+ * Inode table blocks holding the inodes named from entry @i to the end of
+ * its group. Entries are sorted, so those sharing a block are adjacent.
+ */
+static int ext4_evfs_itable_blocks(struct super_block *sb,
+				   struct ext4_evfs_entry *ents, u32 i,
+				   u32 count)
+{
+	unsigned long ipb = EXT4_SB(sb)->s_inodes_per_block;
+	int nr = 0;
+	u32 k;
+
+	for (k = i; k < count && ents[k].ee_group == ents[i].ee_group; k++)
+		if (k == i ||
+		    ents[k].ee_offset / ipb != ents[k - 1].ee_offset / ipb)
+			nr++;
+	return nr;
+}
+
+/*
+ * Choose the groups whose credits are reserved next: from entry @i on, up
+ * to EXT4_EVFS_GROUPS_PER_HANDLE groups within ext4_evfs_max_credits(),
+ * but always at least one. Returns the entry that follows them and sets
+ * @credits to their exact cost: @group_credits for each group's own
+ * blocks (its bitmap and tracker blocks), each distinct descriptor block
+ * and, with @itable, the inode table blocks of the inodes named. EVFS
+ * never dirties the superblock; the free counts it keeps there are only
+ * summed at commit.
+ */
+static u32 ext4_evfs_window(struct super_block *sb, int group_credits,
+			    struct ext4_evfs_entry *ents, u32 i, u32 count,
+			    bool itable, int *credits)
+{
+	int max_credits = ext4_evfs_max_credits(sb);
+	unsigned long desc_block = ULONG_MAX;
+	unsigned int ngroups = 0;
+	int total = 0;
+
+	for (; i < count; i++) {
+		unsigned long block;
+		int need;
+
+		if (ngroups && ents[i].ee_group == ents[i - 1].ee_group)
+			continue;
+
+		block = ents[i].ee_group / EXT4_DESC_PER_BLOCK(sb);
+		need = group_credits + (block != desc_block);
+		if (itable)
+			need += ext4_evfs_itable_blocks(sb, ents, i, count);
+		if (ngroups == EXT4_EVFS_GROUPS_PER_HANDLE ||
+		    (ngroups && total + need > max_credits))
+			break;
+		desc_block = block;
+		total += need;
+		ngroups++;
+	}
+	*credits = total;
+	return i;
+}
+
+/*
+ * Apply the request to every entry. Entries must be sorted by block so
+ * that each group is read, dirtied and checksummed once. Credits are
+ * reserved a window of groups at a time (see ext4_evfs_window()); when
+ * the running transaction can't grow to the next window the handle is
+ * restarted, so a huge operation is spread over as many transactions as
+ * it needs. Each group is complete within one of them.
+ *
+ * With rq_status, rq_status[ee_idx] receives the entry's new bit state or
+ * its own or its group's error and the rest carry on. Without it the
+ * first error ends the operation. If rq_prior is set, bit ee_idx onwards
+ * receives each entry's bits as they were before the change. A non-zero
+ * return means the operation was cut short; rq_changed counts the bits
+ * actually changed either way, and rq_tid is the last transaction any of
+ * them went into.
+ */
+static int ext4_evfs_run(struct super_block *sb, struct ext4_evfs_req *req)
+{
+	handle_t *journal_handle = NULL;	// one active transaction in the journal
+	struct ext4_evfs_entry *ents = req->rq_ents;
+	struct ext4_evfs_group eg;
+	struct ext4_evfs_flex ef = { 0 };
+	struct ext4_evfs_ra ra = { 0 };
+	struct ext4_evfs_info *ei = ext4_evfs_info(sb);
+	u32 count = req->rq_count;
+	__s32 *status = req->rq_status;
+	u32 i = 0, j, window_end = 0;
+	u64 op_start = local_clock(), start;
+	int credits, err = 0;
+
+	req->rq_changed = 0;
+	ext4_evfs_stat_op(ei, EXT4_EVFS_OP_BLOCK + req->rq_mode);
+	trace_ext4_evfs_enter(sb, false, req->rq_mode, count);
+	while (i < count) {
+		ext4_group_t group = ents[i].ee_group;
+		unsigned int new_runs = 0;
+		int ent_err = 0;
+
+		if (i == window_end) {
+			window_end = ext4_evfs_window(sb,
+					1 + ext4_evfs_track_credits(ei),
+					ents, i, count, false, &credits);
+			start = local_clock();
+			if (!journal_handle) {
+				journal_handle = ext4_journal_start_sb(sb,
+						EXT4_HT_MISC, credits);
+				ext4_evfs_stat_latency(ei,
+					EXT4_EVFS_PH_JOURNAL_START, start);
+				trace_ext4_evfs_journal_start(sb, credits,
+					PTR_ERR_OR_ZERO(journal_handle));
+				if (IS_ERR(journal_handle)) {
+					err = PTR_ERR(journal_handle);
+					journal_handle = NULL;
+					break;
+				}
+			} else {
+				err = ext4_journal_ensure_credits(journal_handle,
+								  credits, 0);
+				ext4_evfs_stat_latency(ei,
+					EXT4_EVFS_PH_JOURNAL_START, start);
+				trace_ext4_evfs_journal_extend(sb, credits, err);
+				if (err < 0)
+					break;
+				if (err)
+					this_cpu_inc(ei->ei_stats->es_journal_restarts);
+				err = 0;
+			}
+			ext4_evfs_fc_ineligible(sb, journal_handle);
+		}
+
+		ext4_evfs_readahead(sb, &ra, ents, count);
+
+		// each run of changed bits adds at most one tracked run
+		for (j = i; j < count && ents[j].ee_group == group; j++)
+			new_runs += (ents[j].ee_len + 1) / 2;
+
+		err = ext4_evfs_group_begin(journal_handle, sb, ei, group,
+					    req->rq_mode != EXT4_EVFS_CLEAR,
+					    new_runs, &eg);
+		for (j = i; j < count && ents[j].ee_group == group; j++) {
+			int state = err ?: ent_err;
+
+			if (!state) {
+				state = ext4_evfs_apply(sb, req, &eg, &ents[j]);
+				if (state < 0 && !status)
+					ent_err = state;
+			}
+			if (status) {
+				status[ents[j].ee_idx] = state;
+				// without status the operation's error counts
+				if (state < 0)
+					ext4_evfs_stat_error(ei, state);
+			}
+		}
+		if (!err) {
+			err = ext4_evfs_group_end(journal_handle, sb, ei, &eg);
+			req->rq_changed += eg.eg_changed;
+			ext4_evfs_flex_add(sb, &ef, group, eg.eg_free_delta);
+			if (!err)
+				err = ent_err;
+		}
+
+		/*
+		 * With per-entry status a bad bitmap only fails its own
+		 * entries; an aborted handle means nothing further can be
+		 * journalled.
+		 */
+		if (err && (!status || is_handle_aborted(journal_handle)))
+			break;
+		err = 0;
+
+		i = j;
+		ra.ra_groups--;
+	}
+
+	if (journal_handle) {
+		int err2;
+
+		// later transactions commit after it, so the last tid covers all
+		if (ext4_handle_valid(journal_handle))
+			req->rq_tid = journal_handle->h_transaction->t_tid;
+		start = local_clock();
+		err2 = ext4_journal_stop(journal_handle);
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_JOURNAL_STOP, start);
+		trace_ext4_evfs_journal_stop(sb, 0, err2);
+		if (!err)
+			err = err2;
+	}
+	ext4_evfs_flex_flush(sb, &ef);
+	if (err)
+		ext4_evfs_stat_error(ei, err);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_OP, op_start);
+	trace_ext4_evfs_exit(sb, false, req->rq_mode, count, req->rq_changed,
+			     err);
+	return err;
+}
 
-    switch(cmd) {
-        case EXT4_IOC32_PRINTHELLO: 
-		pr_info("ext4: HELLO\n");
+/*
+ * Inode bitmaps. The same flip/set/clear operations as for blocks, on
+ * inode numbers: each group's inode bitmap is dirtied once, and the
+ * descriptor's free inode, directory and unused inode table counts are
+ * kept in step along with the flex group and filesystem-wide counters.
+ *
+ * As with blocks, EVFS only frees inodes it claimed. Claims are kept in
+ * each group's EXT4_EVFS_TRACK_INODES tracker, and those claimed as
+ * directories in its EXT4_EVFS_TRACK_DIRS one, so they outlive a remount
+ * once there is a tracker file. Claiming an inode zeroes its inode table
+ * entry in the same transaction, so e2fsck or a later iget never take
+ * stale contents for a live inode.
+ */
+
+struct ext4_evfs_itable {
+	struct buffer_head	*it_bh;
+	bool			it_zeroed;	/* an entry in it was zeroed */
+};
+
+/* What ext4_evfs_inode_run() holds of a group while it changes it */
+struct ext4_evfs_inode_group {
+	struct ext4_evfs_group	ig_claims;	/* its inode tracker */
+	struct ext4_evfs_group	ig_dirs;	/* and directory tracker */
+	struct ext4_evfs_itable	*ig_itable;	/* blocks entries may zero */
+	unsigned int		ig_nr_itable;
+};
+
+static bool ext4_evfs_inode_valid(struct super_block *sb, __u64 ino)
+{
+	return ino >= EXT4_FIRST_INO(sb) &&
+	       ino <= le32_to_cpu(EXT4_SB(sb)->s_es->s_inodes_count);
+}
+
+static void ext4_evfs_inode_entry(struct super_block *sb, __u64 ino,
+				  struct ext4_evfs_entry *ent)
+{
+	ent->ee_block = ino;
+	ent->ee_group = (ino - 1) / EXT4_INODES_PER_GROUP(sb);
+	ent->ee_offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	ent->ee_len = 1;
+}
+
+/*
+ * Read @group's inode bitmap like ialloc.c's ext4_read_inode_bitmap(),
+ * which isn't exported: synthesised for an INODE_UNINIT group, read and
+ * checksum-verified otherwise.
+ */
+static struct buffer_head *ext4_evfs_read_inode_bitmap(struct super_block *sb,
+						       ext4_group_t group)
+{
+	struct ext4_group_desc *desc;
+	struct ext4_group_info *grp;
+	struct buffer_head *bh;
+	int err;
+
+	desc = ext4_get_group_desc(sb, group, NULL);
+	grp = ext4_get_group_info(sb, group);
+	if (!desc || !grp)
+		return ERR_PTR(-EFSCORRUPTED);
+	if (EXT4_MB_GRP_IBITMAP_CORRUPT(grp))
+		return ERR_PTR(-EFSCORRUPTED);
+
+	bh = sb_getblk(sb, ext4_inode_bitmap(sb, desc));
+	if (unlikely(!bh))
+		return ERR_PTR(-ENOMEM);
+	if (bitmap_uptodate(bh))
+		goto verify;
+
+	lock_buffer(bh);
+	if (bitmap_uptodate(bh)) {
+		unlock_buffer(bh);
+		goto verify;
+	}
+	ext4_lock_group(sb, group);
+	if (ext4_has_group_desc_csum(sb) &&
+	    (desc->bg_flags & cpu_to_le16(EXT4_BG_INODE_UNINIT))) {
+		memset(bh->b_data, 0, (EXT4_INODES_PER_GROUP(sb) + 7) / 8);
+		ext4_mark_bitmap_end(EXT4_INODES_PER_GROUP(sb),
+				     sb->s_blocksize * 8, bh->b_data);
+		set_bitmap_uptodate(bh);
+		set_buffer_uptodate(bh);
+		set_buffer_verified(bh);
+		ext4_unlock_group(sb, group);
+		unlock_buffer(bh);
+		return bh;
+	}
+	ext4_unlock_group(sb, group);
+	if (buffer_uptodate(bh)) {
+		set_bitmap_uptodate(bh);
+		unlock_buffer(bh);
+		goto verify;
+	}
+	ext4_read_bh(bh, REQ_META | REQ_PRIO, ext4_end_bitmap_read);
+	if (!buffer_uptodate(bh)) {
+		err = -EIO;
+		ext4_error_err(sb, EIO, "Cannot read inode bitmap - "
+			       "block_group = %u", group);
+		goto corrupted;
+	}
+
+verify:
+	if (buffer_verified(bh))
+		return bh;
+	ext4_lock_group(sb, group);
+	if (!buffer_verified(bh)) {
+		if (!ext4_inode_bitmap_csum_verify(sb, desc, bh,
+					EXT4_INODES_PER_GROUP(sb) / 8)) {
+			ext4_unlock_group(sb, group);
+			err = -EFSBADCRC;
+			ext4_error(sb, "Corrupt inode bitmap - block_group = %u",
+				   group);
+			goto corrupted;
+		}
+		set_buffer_verified(bh);
+	}
+	ext4_unlock_group(sb, group);
+	return bh;
+
+corrupted:
+	put_bh(bh);
+	ext4_mark_group_bitmap_corrupted(sb, group,
+					 EXT4_GROUP_INFO_IBITMAP_CORRUPT);
+	return ERR_PTR(err);
+}
+
+/*
+ * Read the inode table blocks of the @nr inodes in @ents and get write
+ * access to them, so that claiming any of them can zero its entry under
+ * the group lock.
+ */
+static int ext4_evfs_itable_get(handle_t *handle, struct super_block *sb,
+				struct ext4_group_desc *gdp,
+				struct ext4_evfs_entry *ents, u32 nr,
+				struct ext4_evfs_inode_group *ig)
+{
+	unsigned long ipb = EXT4_SB(sb)->s_inodes_per_block;
+	struct buffer_head *bh;
+	u32 k;
+	int err;
+
+	ig->ig_itable = kcalloc(ext4_evfs_itable_blocks(sb, ents, 0, nr),
+				sizeof(*ig->ig_itable), GFP_NOFS);
+	if (!ig->ig_itable)
+		return -ENOMEM;
+	for (k = 0; k < nr; k++) {
+		if (k && ents[k].ee_offset / ipb == ents[k - 1].ee_offset / ipb)
+			continue;
+		bh = ext4_sb_bread(sb, ext4_inode_table(sb, gdp) +
+				   ents[k].ee_offset / ipb,
+				   REQ_META | REQ_PRIO);
+		if (IS_ERR(bh))
+			return PTR_ERR(bh);
+		ig->ig_itable[ig->ig_nr_itable++].it_bh = bh;
+		err = ext4_journal_get_write_access(handle, sb, bh,
+						    EXT4_JTR_NONE);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static void ext4_evfs_inode_group_put(struct ext4_evfs_inode_group *ig)
+{
+	unsigned int k;
+
+	ext4_evfs_track_put(&ig->ig_claims);
+	ext4_evfs_track_put(&ig->ig_dirs);
+	for (k = 0; k < ig->ig_nr_itable; k++)
+		brelse(ig->ig_itable[k].it_bh);
+	kfree(ig->ig_itable);
+}
+
+/*
+ * Apply the request to one group's inode bitmap. Caller holds the group
+ * lock and has made @ig's trackers ready for @nr new runs each.
+ * *@free and *@dirs accumulate the change in free inodes and directories.
+ */
+static void ext4_evfs_inode_apply_group(struct super_block *sb,
+					struct ext4_evfs_info *ei,
+					struct ext4_evfs_req *req, bool dir,
+					struct ext4_group_desc *gdp, void *bm,
+					struct ext4_evfs_entry *ents, u32 nr,
+					struct ext4_evfs_inode_group *ig,
+					int *free, int *dirs)
+{
+	unsigned int ipg = EXT4_INODES_PER_GROUP(sb);
+	unsigned long ipb = EXT4_SB(sb)->s_inodes_per_block;
+	struct ext4_evfs_group *cg = &ig->ig_claims, *dg = &ig->ig_dirs;
+	struct ext4_evfs_itable *it = ig->ig_itable;
+	unsigned int used;
+	bool set, was_dir;
+	u32 i;
+
+	for (i = 0; i < nr; i++) {
+		struct ext4_evfs_entry *ent = &ents[i];
+		int old = !!ext4_test_bit(ent->ee_offset, bm);
+		int state;
+
+		// ig_itable has one block per run of entries sharing one
+		if (it && i &&
+		    ent->ee_offset / ipb != ents[i - 1].ee_offset / ipb)
+			it++;
+		if (req->rq_mode == EXT4_EVFS_FLIP)
+			set = !old;
+		else
+			set = req->rq_mode == EXT4_EVFS_SET;
+		if (req->rq_prior && old)
+			ext4_set_bit(ent->ee_idx, req->rq_prior);
+
+		if (set == old) {
+			state = set;
+		} else if (set) {
+			ext4_set_bit(ent->ee_offset, bm);
+			memset(it->it_bh->b_data +
+			       (ent->ee_offset % ipb) * EXT4_INODE_SIZE(sb),
+			       0, EXT4_INODE_SIZE(sb));
+			it->it_zeroed = true;
+			ext4_evfs_track_add(cg->eg_track, &cg->eg_track_spare,
+					    sb->s_blocksize, ent->ee_offset, 1);
+			cg->eg_track_dirty = true;
+			if (dir) {
+				ext4_evfs_track_add(dg->eg_track,
+						    &dg->eg_track_spare,
+						    sb->s_blocksize,
+						    ent->ee_offset, 1);
+				dg->eg_track_dirty = true;
+			}
+			(*free)--;
+			*dirs += dir;
+			// as __ext4_new_inode(): the table is now used this far
+			if (ext4_has_group_desc_csum(sb)) {
+				used = ipg - ext4_itable_unused_count(sb, gdp);
+				if (gdp->bg_flags &
+				    cpu_to_le16(EXT4_BG_INODE_UNINIT)) {
+					gdp->bg_flags &=
+					    cpu_to_le16(~EXT4_BG_INODE_UNINIT);
+					used = 0;
+				}
+				if (ent->ee_offset + 1 > used)
+					ext4_itable_unused_set(sb, gdp,
+						ipg - ent->ee_offset - 1);
+			}
+			req->rq_changed++;
+			state = 1;
+		} else if (!ext4_evfs_track_covers(cg->eg_track, bm,
+						   ent->ee_offset, 1)) {
+			state = -EPERM;
+		} else {
+			was_dir = ext4_evfs_track_covers(dg->eg_track, bm,
+							 ent->ee_offset, 1);
+			ext4_clear_bit(ent->ee_offset, bm);
+			ext4_evfs_track_del(cg->eg_track, &cg->eg_track_spare,
+					    sb->s_blocksize, ent->ee_offset, 1);
+			cg->eg_track_dirty = true;
+			if (was_dir) {
+				ext4_evfs_track_del(dg->eg_track,
+						    &dg->eg_track_spare,
+						    sb->s_blocksize,
+						    ent->ee_offset, 1);
+				dg->eg_track_dirty = true;
+			}
+			(*free)++;
+			*dirs -= was_dir;
+			req->rq_changed++;
+			state = 0;
+		}
+		trace_ext4_evfs_apply(sb, ent->ee_block, ent->ee_group,
+				      ent->ee_offset, 1, state < 0 ? -1 : old,
+				      state);
+		if (req->rq_status)
+			req->rq_status[ent->ee_idx] = state;
+		if (state < 0)
+			ext4_evfs_stat_error(ei, state);
+	}
+}
+
+/*
+ * As __ext4_new_inode() does before taking an inode from a group: while
+ * it is BLOCK_UNINIT its block bitmap is only synthesised on read, so
+ * write it out for real and clear the flag before the group's inode
+ * counts change. The caller has write access to @gdp's block.
+ */
+static int ext4_evfs_init_block_bitmap(handle_t *handle,
+				       struct super_block *sb,
+				       ext4_group_t group,
+				       struct ext4_group_desc *gdp)
+{
+	struct buffer_head *bh;
+	int err;
+
+	if (!ext4_has_group_desc_csum(sb) ||
+	    !(gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)))
 		return 0;
-	case EXT4_IOC_FLIP_BLOCK_BIT: {
-		// TODO: update free block counter
-		__u64 block_number;
-		ext4_group_t group;
-		ext4_grpblk_t offset;
-		struct buffer_head *bitmap_bh;
-		struct ext4_group_desc *group_descriptor;
-		struct buffer_head *group_descriptor_bh;	// buffer for group descriptor block
-        struct ext4_sb_info *sbi = EXT4_SB(sb); // superblock info
-		handle_t *journal_handle;	// one active transaction in the journal
-		int err;
-        int was_set;    // whether bit was set BEFORE the flip
-
-		if (copy_from_user(&block_number, (void __user *)arg, sizeof(block_number))) {
-			return -EFAULT;
-		}
-
-		ext4_get_group_no_and_offset(sb, (ext4_fsblk_t)block_number, &group, &offset);
-
-		bitmap_bh = ext4_read_block_bitmap(sb, group);
+	bh = ext4_read_block_bitmap(sb, group);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	err = ext4_journal_get_write_access(handle, sb, bh, EXT4_JTR_NONE);
+	if (!err)
+		err = ext4_handle_dirty_metadata(handle, NULL, bh);
+	if (!err) {
+		// recheck under the lock, someone may have got there first
+		ext4_lock_group(sb, group);
+		if (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) {
+			gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+			ext4_free_group_clusters_set(sb, gdp,
+				ext4_free_clusters_after_init(sb, group, gdp));
+			ext4_block_bitmap_csum_set(sb, gdp, bh);
+			ext4_group_desc_csum_set(sb, group, gdp);
+		}
+		ext4_unlock_group(sb, group);
+	}
+	brelse(bh);
+	return err;
+}
+
+/*
+ * ext4_evfs_run() for inode numbers: same entry, status and prior-state
+ * conventions, except that every entry is a single inode, a rejected
+ * entry never stops the others and any group's error ends the operation.
+ * With @dir, inodes claimed are counted as directories.
+ */
+static int ext4_evfs_inode_run(struct super_block *sb,
+			       struct ext4_evfs_req *req, bool dir)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_evfs_info *ei = ext4_evfs_info(sb);
+	struct ext4_evfs_entry *ents = req->rq_ents;
+	bool claim = req->rq_mode != EXT4_EVFS_CLEAR;
+	struct ext4_evfs_inode_group ig;
+	handle_t *handle = NULL;
+	u32 count = req->rq_count;
+	u32 i = 0, j, k, window_end = 0;
+	u64 op_start = local_clock(), start, changed;
+	int credits, err = 0;
+
+	req->rq_changed = 0;
+	ext4_evfs_stat_op(ei, EXT4_EVFS_OP_INODE + req->rq_mode);
+	trace_ext4_evfs_enter(sb, true, req->rq_mode, count);
+	while (i < count) {
+		ext4_group_t group = ents[i].ee_group;
+		struct ext4_group_info *grp = ext4_get_group_info(sb, group);
+		struct ext4_evfs_group_stats *gs;
+		struct buffer_head *bitmap_bh, *gdp_bh;
+		struct ext4_group_desc *gdp;
+		int free = 0, dirs = 0;
+
+		if (i == window_end) {
+			/*
+			 * The inode bitmap, a BLOCK_UNINIT group's block one,
+			 * both trackers and the inode table blocks zeroed
+			 */
+			window_end = ext4_evfs_window(sb,
+					2 + 2 * ext4_evfs_track_credits(ei),
+					ents, i, count, claim, &credits);
+			start = local_clock();
+			if (!handle) {
+				handle = ext4_journal_start_sb(sb, EXT4_HT_MISC,
+							       credits);
+				ext4_evfs_stat_latency(ei,
+					EXT4_EVFS_PH_JOURNAL_START, start);
+				trace_ext4_evfs_journal_start(sb, credits,
+						PTR_ERR_OR_ZERO(handle));
+				if (IS_ERR(handle)) {
+					err = PTR_ERR(handle);
+					handle = NULL;
+					break;
+				}
+			} else {
+				err = ext4_journal_ensure_credits(handle,
+								  credits, 0);
+				ext4_evfs_stat_latency(ei,
+					EXT4_EVFS_PH_JOURNAL_START, start);
+				trace_ext4_evfs_journal_extend(sb, credits, err);
+				if (err < 0)
+					break;
+				if (err)
+					this_cpu_inc(ei->ei_stats->es_journal_restarts);
+				err = 0;
+			}
+			ext4_evfs_fc_ineligible(sb, handle);
+		}
+		for (j = i; j < count && ents[j].ee_group == group; j++)
+			;
+
+		start = local_clock();
+		bitmap_bh = ext4_evfs_read_inode_bitmap(sb, group);
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_READ_BITMAP, start);
+		trace_ext4_evfs_read_bitmap(sb, group,
+					    PTR_ERR_OR_ZERO(bitmap_bh));
 		if (IS_ERR(bitmap_bh)) {
-			return PTR_ERR(bitmap_bh);
+			err = PTR_ERR(bitmap_bh);
+			break;
 		}
+		gdp = ext4_get_group_desc(sb, group, &gdp_bh);
+		if (!gdp || !grp) {
+			err = -EFSCORRUPTED;
+			goto next;
+		}
+		start = local_clock();
+		err = ext4_journal_get_write_access(handle, sb, bitmap_bh,
+						    EXT4_JTR_NONE);
+		if (!err)
+			err = ext4_journal_get_write_access(handle, sb, gdp_bh,
+							    EXT4_JTR_NONE);
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_WRITE_ACCESS, start);
+		trace_ext4_evfs_write_access(sb, group, err);
+		if (err)
+			goto next;
 
-		group_descriptor = ext4_get_group_desc(sb, group, &group_descriptor_bh);
-		if (!group_descriptor) {
-			brelse(bitmap_bh);
-			return -EIO;
+		gs = ext4_evfs_group_stats(ei, group);
+		memset(&ig, 0, sizeof(ig));
+		ig.ig_claims.eg_group = ig.ig_dirs.eg_group = group;
+		ig.ig_claims.eg_track_slot = ext4_evfs_track_slot(group,
+						EXT4_EVFS_TRACK_INODES);
+		ig.ig_dirs.eg_track_slot = ext4_evfs_track_slot(group,
+						EXT4_EVFS_TRACK_DIRS);
+		ig.ig_claims.eg_track = ext4_evfs_track_get(ei,
+				ig.ig_claims.eg_track_slot, claim);
+		if (IS_ERR(ig.ig_claims.eg_track)) {
+			err = PTR_ERR(ig.ig_claims.eg_track);
+			ig.ig_claims.eg_track = NULL;
+			goto release;
+		}
+		ig.ig_dirs.eg_track = ext4_evfs_track_get(ei,
+				ig.ig_dirs.eg_track_slot, claim && dir);
+		if (IS_ERR(ig.ig_dirs.eg_track)) {
+			err = PTR_ERR(ig.ig_dirs.eg_track);
+			ig.ig_dirs.eg_track = NULL;
+			goto release;
 		}
+		if (claim) {
+			err = ext4_evfs_itable_get(handle, sb, gdp, &ents[i],
+						   j - i, &ig);
+			if (err)
+				goto release;
+		}
+		err = ext4_evfs_init_block_bitmap(handle, sb, group, gdp);
+		if (err)
+			goto release;
 
-		// start a journal transaction
-		// 3 blocks are affected (group descriptor, data bitmap, superblock)
-		journal_handle = ext4_journal_start_sb(sb, EXT4_HT_MISC, 3);
-		if (IS_ERR(journal_handle)) {
-			brelse(bitmap_bh);
-			return PTR_ERR(journal_handle);
+		for (;;) {
+			// as __ext4_new_inode(), keep out lazy inode table init
+			if (ext4_has_group_desc_csum(sb))
+				down_read(&grp->alloc_sem);
+			ext4_lock_group(sb, group);
+			if (ext4_evfs_track_ready(ei, &ig.ig_claims, j - i) &&
+			    ext4_evfs_track_ready(ei, &ig.ig_dirs, j - i))
+				break;
+			// can't allocate or read blocks under the group lock
+			ext4_unlock_group(sb, group);
+			if (ext4_has_group_desc_csum(sb))
+				up_read(&grp->alloc_sem);
+			if (ig.ig_claims.eg_track)
+				err = ext4_evfs_track_prepare(handle, ei,
+						&ig.ig_claims, j - i);
+			if (!err && ig.ig_dirs.eg_track)
+				err = ext4_evfs_track_prepare(handle, ei,
+						&ig.ig_dirs, j - i);
+			if (err)
+				goto release;
+		}
+		ext4_evfs_group_stats_note(gs);
+		changed = req->rq_changed;
+		ext4_evfs_inode_apply_group(sb, ei, req, dir, gdp,
+					    bitmap_bh->b_data, &ents[i], j - i,
+					    &ig, &free, &dirs);
+		if (free)
+			ext4_free_inodes_set(sb, gdp,
+				ext4_free_inodes_count(sb, gdp) + free);
+		if (dirs)
+			ext4_used_dirs_set(sb, gdp,
+				ext4_used_dirs_count(sb, gdp) + dirs);
+		ext4_inode_bitmap_csum_set(sb, gdp, bitmap_bh,
+					   EXT4_INODES_PER_GROUP(sb) / 8);
+		ext4_group_desc_csum_set(sb, group, gdp);
+		if (ei->ei_track_inode) {
+			if (ig.ig_claims.eg_track_dirty)
+				ext4_evfs_track_store(ei, &ig.ig_claims);
+			if (ig.ig_dirs.eg_track_dirty)
+				ext4_evfs_track_store(ei, &ig.ig_dirs);
 		}
+		ext4_unlock_group(sb, group);
+		if (ext4_has_group_desc_csum(sb))
+			up_read(&grp->alloc_sem);
 
-		// get write access to bitmap thru journal
-		err = ext4_journal_get_write_access(journal_handle, sb, bitmap_bh, EXT4_JTR_NONE);
-		if (err) {
-			goto out_journal;
+		if (free) {
+			percpu_counter_add(&sbi->s_freeinodes_counter, free);
+			if (sbi->s_log_groups_per_flex)
+				atomic_add(free, &sbi_array_rcu_deref(sbi,
+					s_flex_groups,
+					ext4_flex_group(sbi, group))->free_inodes);
+		}
+		if (dirs) {
+			percpu_counter_add(&sbi->s_dirs_counter, dirs);
+			if (sbi->s_log_groups_per_flex)
+				atomic_add(dirs, &sbi_array_rcu_deref(sbi,
+					s_flex_groups,
+					ext4_flex_group(sbi, group))->used_dirs);
 		}
 
-		// get write access to group descriptor thru journal
-		err = ext4_journal_get_write_access(journal_handle, sb, group_descriptor_bh, EXT4_JTR_NONE);
-		if (err) {
-			goto out_journal;
+		start = local_clock();
+		err = ext4_handle_dirty_metadata(handle, NULL, bitmap_bh);
+		if (!err)
+			err = ext4_handle_dirty_metadata(handle, NULL, gdp_bh);
+		for (k = 0; !err && k < ig.ig_nr_itable; k++)
+			if (ig.ig_itable[k].it_zeroed)
+				err = ext4_handle_dirty_metadata(handle, NULL,
+						ig.ig_itable[k].it_bh);
+		if (!err && ei->ei_track_inode) {
+			if (ig.ig_claims.eg_track_dirty)
+				err = ext4_evfs_track_dirty(handle, ei,
+							    &ig.ig_claims);
+			if (!err && ig.ig_dirs.eg_track_dirty)
+				err = ext4_evfs_track_dirty(handle, ei,
+							    &ig.ig_dirs);
 		}
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_DIRTY, start);
+		ext4_evfs_stat_bits(ei, req->rq_changed - changed, free);
+		trace_ext4_evfs_dirty_metadata(sb, group, err);
+release:
+		ext4_evfs_inode_group_put(&ig);
+next:
+		brelse(bitmap_bh);
+		if (err)
+			break;
+		i = j;
+	}
 
-        /*
-        write access is not needed for superblock. percpu() are atomic in-mem updates
-        */
+	if (handle) {
+		int err2;
 
-		// flip bit
-		was_set = ext4_test_bit(offset, bitmap_bh->b_data);
-		if (was_set) {
-			ext4_clear_bit(offset, bitmap_bh->b_data);
-			pr_info("ext4: Cleared bit %d in group %u\n", offset, group);
+		if (ext4_handle_valid(handle))
+			req->rq_tid = handle->h_transaction->t_tid;
+		start = local_clock();
+		err2 = ext4_journal_stop(handle);
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_JOURNAL_STOP, start);
+		trace_ext4_evfs_journal_stop(sb, 0, err2);
+		if (!err)
+			err = err2;
+	}
+	if (err)
+		ext4_evfs_stat_error(ei, err);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_OP, op_start);
+	trace_ext4_evfs_exit(sb, true, req->rq_mode, count, req->rq_changed,
+			     err);
+	return err;
+}
+
+/*
+ * Make the changes an operation put in transaction @tid as durable as
+ * @flags ask, as ext4_sync_file() does: wait for the commit, which starts
+ * it unless it's already on its way so concurrent callers share it, and
+ * for EXT4_EVFS_BATCH_SYNC flush the device unless the commit already
+ * did.
+ */
+static int ext4_evfs_durable(struct super_block *sb, tid_t tid, u32 flags)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	bool needs_barrier = false;
+	int err;
+
+	if (!(flags & EXT4_EVFS_DURABLE_FLAGS))
+		return 0;
+	if (journal) {
+		if (flags & EXT4_EVFS_BATCH_SYNC &&
+		    journal->j_flags & JBD2_BARRIER &&
+		    !jbd2_trans_will_send_data_barrier(journal, tid))
+			needs_barrier = true;
+		err = jbd2_complete_transaction(journal, tid);
+	} else {
+		needs_barrier = flags & EXT4_EVFS_BATCH_SYNC &&
+				test_opt(sb, BARRIER);
+		err = sync_blockdev(sb->s_bdev);
+	}
+	if (!err && needs_barrier)
+		err = blkdev_issue_flush(sb->s_bdev);
+	return err;
+}
+
+static long ext4_evfs_ioctl_flip_block(struct file *filp, unsigned long arg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_entry ent = { .ee_len = 1, .ee_idx = 0 };
+	__s32 status = -ECANCELED;
+	struct ext4_evfs_req req = {
+		.rq_mode = EXT4_EVFS_FLIP,
+		.rq_ents = &ent,
+		.rq_count = 1,
+		.rq_status = &status,
+	};
+	__u64 block_number;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&block_number, (void __user *)arg,
+			   sizeof(block_number)))
+		return -EFAULT;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	if (!ext4_evfs_block_valid(sb, block_number))
+		return -EINVAL;
+
+	ent.ee_block = block_number;
+	ext4_get_group_no_and_offset(sb, ent.ee_block, &ent.ee_group,
+				     &ent.ee_offset);
+
+	err = ext4_evfs_want_write(filp);
+	if (err)
+		return err;
+	err = ext4_evfs_run(sb, &req);
+	mnt_drop_write_file(filp);
+	if (err)
+		return err;
+	return status < 0 ? status : 0;
+}
+
+static long ext4_evfs_ioctl_flip_inode(struct file *filp, unsigned long arg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_entry ent = { .ee_idx = 0 };
+	__s32 status = -ECANCELED;
+	struct ext4_evfs_req req = {
+		.rq_mode = EXT4_EVFS_FLIP,
+		.rq_ents = &ent,
+		.rq_count = 1,
+		.rq_status = &status,
+	};
+	__u64 ino;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&ino, (void __user *)arg, sizeof(ino)))
+		return -EFAULT;
+	if (sb_rdonly(sb))
+		return -EROFS;
+	if (!ext4_evfs_inode_valid(sb, ino))
+		return -EINVAL;
+	ext4_evfs_inode_entry(sb, ino, &ent);
+
+	err = ext4_evfs_want_write(filp);
+	if (err)
+		return err;
+	err = ext4_evfs_inode_run(sb, &req, false);
+	mnt_drop_write_file(filp);
+	if (err)
+		return err;
+	return status < 0 ? status : 0;
+}
+
+/*
+ * EXT4_IOC_FLIP_BLOCK_BITS, or with @inodes EXT4_IOC_FLIP_INODE_BITS,
+ * whose eb_blocks holds inode numbers instead.
+ */
+static long ext4_evfs_ioctl_flip_batch(struct file *filp, unsigned long arg,
+				       bool inodes)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_batch batch;
+	struct ext4_evfs_req req = { .rq_mode = EXT4_EVFS_FLIP };
+	__u32 valid_flags = EXT4_EVFS_BATCH_VALID_FLAGS;
+	struct ext4_evfs_entry *ents = NULL;
+	__u64 *blocks = NULL;
+	__s32 *status = NULL;
+	void *prior = NULL;
+	u32 i, nr = 0;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+		return -EFAULT;
+	if (inodes)
+		valid_flags |= EXT4_EVFS_BATCH_DIR;
+	if ((batch.eb_flags & ~valid_flags) ||
+	    (batch.eb_flags & EXT4_EVFS_BATCH_SET &&
+	     batch.eb_flags & EXT4_EVFS_BATCH_CLEAR) ||
+	    !batch.eb_count || batch.eb_count > EXT4_EVFS_MAX_BATCH)
+		return -EINVAL;
+	// one bit per inode, whatever the cluster size
+	err = inodes ? (sb_rdonly(sb) ? -EROFS : 0) :
+		       ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	if (batch.eb_flags & EXT4_EVFS_BATCH_SET)
+		req.rq_mode = EXT4_EVFS_SET;
+	else if (batch.eb_flags & EXT4_EVFS_BATCH_CLEAR)
+		req.rq_mode = EXT4_EVFS_CLEAR;
+
+	blocks = kvmalloc_array(batch.eb_count, sizeof(*blocks), GFP_KERNEL);
+	status = kvmalloc_array(batch.eb_count, sizeof(*status), GFP_KERNEL);
+	ents = kvmalloc_array(batch.eb_count, sizeof(*ents), GFP_KERNEL);
+	if (batch.eb_prior)
+		prior = kvzalloc(DIV_ROUND_UP(batch.eb_count, 8), GFP_KERNEL);
+	if (!blocks || !status || !ents || (batch.eb_prior && !prior)) {
+		err = -ENOMEM;
+		goto out;
+	}
+	if (copy_from_user(blocks, u64_to_user_ptr(batch.eb_blocks),
+			   batch.eb_count * sizeof(*blocks))) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < batch.eb_count; i++) {
+		if (inodes ? !ext4_evfs_inode_valid(sb, blocks[i]) :
+			     !ext4_evfs_block_valid(sb, blocks[i])) {
+			status[i] = -EINVAL;
+			continue;
+		}
+		status[i] = -ECANCELED;
+		ents[nr].ee_idx = i;
+		if (inodes) {
+			ext4_evfs_inode_entry(sb, blocks[i], &ents[nr]);
 		} else {
-			ext4_set_bit(offset, bitmap_bh->b_data);
-			pr_info("ext4: Set bit %d in group %u\n", offset, group);
-		}
-
-        // update group descriptor free block count
-        if (was_set) {  // was 1, now is 0. free blocks is 1 more
-            ext4_free_group_clusters_set(sb, group_descriptor, 
-                ext4_free_group_clusters(sb, group_descriptor) + 1);
-        } else {        // was 0 and now 1, one less free block
-            ext4_free_group_clusters_set(sb, group_descriptor, 
-                ext4_free_group_clusters(sb, group_descriptor) - 1);
-        }
-        // update superblock free block count
-        if (was_set) {
-            percpu_counter_add(&sbi->s_freeclusters_counter, 1);
-        } else {
-            percpu_counter_sub(&sbi->s_freeclusters_counter, 1);
-        }
-
-		// update bitmap checksum
-		ext4_block_bitmap_csum_set(sb, group_descriptor, bitmap_bh);
-		// update group descriptor checksum
-		ext4_group_desc_csum_set(sb, group, group_descriptor);
-        /*
-        superblock checksum is automatically updated when 
-        the superblock is written to disk
-        */
-
-		// add bitmap changes to transaction
-		err = ext4_handle_dirty_metadata(journal_handle, NULL, bitmap_bh);
-		if (err) { goto out_journal; }
-
-		// add group descriptor changes to transaction 
-		err = ext4_handle_dirty_metadata(journal_handle, NULL, group_descriptor_bh);
-		if (err) { goto out_journal; }
-
-		// commit transaction
-		// keep this separate from out_journal since we are updating err here
-		err = ext4_journal_stop(journal_handle);
-		brelse(bitmap_bh);
+			ents[nr].ee_block = blocks[i];
+			ents[nr].ee_len = 1;
+			ext4_get_group_no_and_offset(sb, blocks[i],
+						     &ents[nr].ee_group,
+						     &ents[nr].ee_offset);
+		}
+		nr++;
+	}
+	sort(ents, nr, sizeof(*ents), ext4_evfs_entry_cmp, NULL);
+
+	if (nr) {
+		err = ext4_evfs_want_write(filp);
+		if (err)
+			goto out;
+		req.rq_ents = ents;
+		req.rq_count = nr;
+		req.rq_status = status;
+		req.rq_prior = prior;
+		if (inodes)
+			err = ext4_evfs_inode_run(sb, &req,
+				batch.eb_flags & EXT4_EVFS_BATCH_DIR);
+		else
+			err = ext4_evfs_run(sb, &req);
+		mnt_drop_write_file(filp);
+		if (!err && req.rq_changed)
+			err = ext4_evfs_durable(sb, req.rq_tid, batch.eb_flags);
+	}
+
+	if (copy_to_user(u64_to_user_ptr(batch.eb_status), status,
+			 batch.eb_count * sizeof(*status)) && !err)
+		err = -EFAULT;
+	if (prior && copy_to_user(u64_to_user_ptr(batch.eb_prior), prior,
+				  DIV_ROUND_UP(batch.eb_count, 8)) && !err)
+		err = -EFAULT;
+out:
+	kvfree(prior);
+	kvfree(ents);
+	kvfree(status);
+	kvfree(blocks);
+	return err;
+}
+
+/*
+ * Split the validated range [start, start + len) into one entry per block
+ * group it touches. Returns the number of entries, or 0 on allocation
+ * failure.
+ */
+static u32 ext4_evfs_split_range(struct super_block *sb, __u64 start,
+				 __u64 len, struct ext4_evfs_entry **entsp)
+{
+	struct ext4_evfs_entry *ents;
+	ext4_group_t first, last;
+	ext4_grpblk_t offset;
+	__u64 block = start;
+	u32 i, nr;
+
+	ext4_get_group_no_and_offset(sb, start, &first, &offset);
+	ext4_get_group_no_and_offset(sb, start + len - 1, &last, &offset);
+	nr = last - first + 1;
+	ents = kvmalloc_array(nr, sizeof(*ents), GFP_KERNEL);
+	if (!ents)
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		ents[i].ee_block = block;
+		ents[i].ee_idx = block - start;
+		ext4_get_group_no_and_offset(sb, block, &ents[i].ee_group,
+					     &ents[i].ee_offset);
+		ents[i].ee_len = min_t(__u64, start + len - block,
+				EXT4_CLUSTERS_PER_GROUP(sb) - ents[i].ee_offset);
+		block += ents[i].ee_len;
+	}
+	*entsp = ents;
+	return nr;
+}
+
+static long ext4_evfs_ioctl_range(struct file *filp, unsigned long arg,
+				  int mode)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_range range;
+	struct ext4_evfs_req req = { .rq_mode = mode };
+	struct ext4_evfs_entry *ents = NULL;
+	void *prior = NULL;
+	u32 nr;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&range, (void __user *)arg, sizeof(range)))
+		return -EFAULT;
+	if ((range.er_flags & ~EXT4_EVFS_DURABLE_FLAGS) || range.er_pad)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	if (!range.er_len ||
+	    range.er_start + range.er_len < range.er_start ||
+	    !ext4_evfs_block_valid(sb, range.er_start) ||
+	    !ext4_evfs_block_valid(sb, range.er_start + range.er_len - 1))
+		return -EINVAL;
+	if (range.er_prior && range.er_len > EXT4_EVFS_MAX_BITS)
+		return -E2BIG;
+
+	nr = ext4_evfs_split_range(sb, range.er_start, range.er_len, &ents);
+	if (!nr)
+		return -ENOMEM;
+	if (range.er_prior) {
+		prior = kvzalloc(DIV_ROUND_UP(range.er_len, 8), GFP_KERNEL);
+		if (!prior) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	err = ext4_evfs_want_write(filp);
+	if (err)
+		goto out;
+	req.rq_ents = ents;
+	req.rq_count = nr;
+	req.rq_prior = prior;
+	err = ext4_evfs_run(sb, &req);
+	mnt_drop_write_file(filp);
+	if (!err && req.rq_changed)
+		err = ext4_evfs_durable(sb, req.rq_tid, range.er_flags);
+
+	range.er_changed = req.rq_changed;
+	if (copy_to_user((void __user *)arg, &range, sizeof(range)) && !err)
+		err = -EFAULT;
+	if (prior && copy_to_user(u64_to_user_ptr(range.er_prior), prior,
+				  DIV_ROUND_UP(range.er_len, 8)) && !err)
+		err = -EFAULT;
+out:
+	kvfree(prior);
+	kvfree(ents);
+	return err;
+}
+
+/*
+ * Copy the allocation bits of [eq_start, eq_start + eq_len) to user space
+ * straight from the cached block bitmaps. Nothing is journalled, so this
+ * works on read-only mounts too.
+ */
+static long ext4_evfs_ioctl_get_bits(struct file *filp, unsigned long arg)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_query query;
+	struct ext4_evfs_entry *ents = NULL;
+	struct ext4_evfs_ra ra = { 0 };
+	struct ext4_evfs_info *ei;
+	struct buffer_head *bitmap_bh;
+	void *bits = NULL;
+	u64 op_start, start;
+	u32 i, nr;
+	int err;
+
+	if (copy_from_user(&query, (void __user *)arg, sizeof(query)))
+		return -EFAULT;
+	if (query.eq_flags || query.eq_pad)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, false);
+	if (err)
 		return err;
+	if (!query.eq_len ||
+	    query.eq_start + query.eq_len < query.eq_start ||
+	    !ext4_evfs_block_valid(sb, query.eq_start) ||
+	    !ext4_evfs_block_valid(sb, query.eq_start + query.eq_len - 1))
+		return -EINVAL;
+	if (query.eq_len > EXT4_EVFS_MAX_BITS)
+		return -E2BIG;
+	ei = ext4_evfs_info(sb);
+	op_start = local_clock();
+	ext4_evfs_stat_op(ei, EXT4_EVFS_OP_QUERY);
 
-out_journal:
-		ext4_journal_stop(journal_handle);
+	nr = ext4_evfs_split_range(sb, query.eq_start, query.eq_len, &ents);
+	if (!nr) {
+		err = -ENOMEM;
+		goto out;
+	}
+	bits = kvmalloc(DIV_ROUND_UP(query.eq_len, 8), GFP_KERNEL);
+	if (!bits) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ext4_evfs_readahead(sb, &ra, ents, nr);
+		start = local_clock();
+		bitmap_bh = ext4_read_block_bitmap(sb, ents[i].ee_group);
+		ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_READ_BITMAP, start);
+		if (IS_ERR(bitmap_bh)) {
+			err = PTR_ERR(bitmap_bh);
+			goto out;
+		}
+		// mballoc updates the bitmap under the group lock
+		ext4_lock_group(sb, ents[i].ee_group);
+		ext4_evfs_copy_bits(bits, ents[i].ee_idx, bitmap_bh->b_data,
+				    ents[i].ee_offset, ents[i].ee_len);
+		ext4_unlock_group(sb, ents[i].ee_group);
 		brelse(bitmap_bh);
+		ra.ra_groups--;
+	}
+
+	if (copy_to_user(u64_to_user_ptr(query.eq_bits), bits,
+			 DIV_ROUND_UP(query.eq_len, 8)))
+		err = -EFAULT;
+out:
+	kvfree(bits);
+	kvfree(ents);
+	if (err)
+		ext4_evfs_stat_error(ei, err);
+	ext4_evfs_stat_latency(ei, EXT4_EVFS_PH_OP, op_start);
+	return err;
+}
+
+/*
+ * Asynchronous submission. EXT4_IOC_SUBMIT_BLOCK_BITS only validates its
+ * blocks and queues them; the single worker of ei_async_wq takes all that
+ * is queued at once and applies consecutive jobs of the same mode as one
+ * ext4_evfs_run(), so a burst of small submissions shares handles and
+ * dirties each group once. A job keeps its file, and with it write access
+ * to the mount, until it is done.
+ *
+ * Tickets belong to the submitter fd the job came through, so they can
+ * only be collected there and never outlive it: closing it cancels its
+ * jobs still queued, waits out those the worker has taken and frees
+ * them all.
+ */
+struct ext4_evfs_submitter {
+	struct file		*su_file;	/* the file it was opened from */
+	struct ext4_evfs_info	*su_ei;
+	struct xarray		su_tickets;	/* ticket -> job until collected */
+	u32			su_next_ticket;
+	atomic_t		su_nr_tickets;
+};
+
+static void ext4_evfs_async_complete(struct ext4_evfs_info *ei,
+				     struct ext4_evfs_async_job *job,
+				     int result, tid_t tid)
+{
+	struct file *file = job->aj_file;
+	struct eventfd_ctx *eventfd = job->aj_eventfd;
+
+	kvfree(job->aj_ents);
+	job->aj_ents = NULL;
+	job->aj_result = result;
+	job->aj_tid = tid;
+	// once this is seen the job can be collected and freed
+	smp_store_release(&job->aj_done, true);
+	wake_up_all(&ei->ei_async_wait);
+	if (eventfd) {
+		eventfd_signal(eventfd);
+		eventfd_ctx_put(eventfd);
+	}
+	mnt_drop_write_file(file);
+	fput(file);
+}
+
+/* Apply @jobs, all of one mode and @total entries between them, at once */
+static void ext4_evfs_async_run(struct ext4_evfs_info *ei,
+				struct list_head *jobs, u32 total)
+{
+	struct ext4_evfs_async_job *job, *tmp;
+	struct ext4_evfs_req req = { 0 };
+	struct ext4_evfs_entry *ents;
+	__s32 *status;
+	u32 base = 0, flags = 0, i;
+	int err, result;
+
+	job = list_first_entry(jobs, struct ext4_evfs_async_job, aj_list);
+	req.rq_mode = job->aj_mode;
+	ents = kvmalloc_array(total, sizeof(*ents), GFP_KERNEL);
+	status = kvmalloc_array(total, sizeof(*status), GFP_KERNEL);
+	if (!ents || !status) {
+		err = -ENOMEM;
+		goto out;
+	}
+	list_for_each_entry(job, jobs, aj_list) {
+		for (i = 0; i < job->aj_count; i++) {
+			ents[base + i] = job->aj_ents[i];
+			ents[base + i].ee_idx = base + i;
+			status[base + i] = -ECANCELED;
+		}
+		base += job->aj_count;
+		flags |= job->aj_flags;
+	}
+	// ee_idx follows submission order, so repeated flips still compose
+	sort(ents, total, sizeof(*ents), ext4_evfs_entry_cmp, NULL);
+	req.rq_ents = ents;
+	req.rq_count = total;
+	req.rq_status = status;
+	err = ext4_evfs_run(ei->ei_sb, &req);
+	// one wait makes the whole lot durable
+	if (!err && req.rq_changed)
+		err = ext4_evfs_durable(ei->ei_sb, req.rq_tid, flags);
+
+out:
+	base = 0;
+	list_for_each_entry_safe(job, tmp, jobs, aj_list) {
+		result = err;
+		for (i = 0; !result && i < job->aj_count; i++)
+			if (status[base + i] < 0)
+				result = status[base + i];
+		base += job->aj_count;
+		list_del(&job->aj_list);
+		ext4_evfs_async_complete(ei, job, result, req.rq_tid);
+	}
+	kvfree(status);
+	kvfree(ents);
+}
+
+static void ext4_evfs_async_work(struct work_struct *work)
+{
+	struct ext4_evfs_info *ei = container_of(work, struct ext4_evfs_info,
+						 ei_async_work);
+	struct ext4_evfs_async_job *job, *tmp;
+	LIST_HEAD(queue);
+	LIST_HEAD(run);
+	u32 total;
+	int mode;
+
+	spin_lock(&ei->ei_async_lock);
+	list_splice_init(&ei->ei_async_queue, &queue);
+	spin_unlock(&ei->ei_async_lock);
+
+	while (!list_empty(&queue)) {
+		mode = list_first_entry(&queue, struct ext4_evfs_async_job,
+					aj_list)->aj_mode;
+		total = 0;
+		// each job is at most EXT4_EVFS_MAX_BATCH, so one always fits
+		list_for_each_entry_safe(job, tmp, &queue, aj_list) {
+			if (job->aj_mode != mode ||
+			    total + job->aj_count > EXT4_EVFS_MAX_BATCH)
+				break;
+			list_move_tail(&job->aj_list, &run);
+			total += job->aj_count;
+		}
+		ext4_evfs_async_run(ei, &run, total);
+	}
+}
+
+static long ext4_evfs_submitter_submit(struct ext4_evfs_submitter *su,
+				       unsigned long arg)
+{
+	struct file *filp = su->su_file;
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_async __user *uarg = (void __user *)arg;
+	struct ext4_evfs_info *ei = su->su_ei;
+	struct ext4_evfs_async_job *job = NULL;
+	struct ext4_evfs_async ea;
+	__u64 *blocks = NULL;
+	u32 i;
+	int err;
+
+	if (copy_from_user(&ea, uarg, sizeof(ea)))
+		return -EFAULT;
+	if ((ea.ea_flags & ~EXT4_EVFS_BATCH_VALID_FLAGS) ||
+	    (ea.ea_flags & EXT4_EVFS_BATCH_SET &&
+	     ea.ea_flags & EXT4_EVFS_BATCH_CLEAR) ||
+	    ea.ea_pad || !ea.ea_count || ea.ea_count > EXT4_EVFS_MAX_BATCH)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+
+	err = -ENOMEM;
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		goto out_free;
+	blocks = kvmalloc_array(ea.ea_count, sizeof(*blocks), GFP_KERNEL);
+	job->aj_ents = kvmalloc_array(ea.ea_count, sizeof(*job->aj_ents),
+				      GFP_KERNEL);
+	if (!blocks || !job->aj_ents)
+		goto out_free;
+	err = -EFAULT;
+	if (copy_from_user(blocks, u64_to_user_ptr(ea.ea_blocks),
+			   ea.ea_count * sizeof(*blocks)))
+		goto out_free;
+	// nothing is reported per block, so one bad block fails them all
+	err = -EINVAL;
+	for (i = 0; i < ea.ea_count; i++) {
+		struct ext4_evfs_entry *ent = &job->aj_ents[i];
+
+		if (!ext4_evfs_block_valid(sb, blocks[i]))
+			goto out_free;
+		ent->ee_block = blocks[i];
+		ent->ee_len = 1;
+		ext4_get_group_no_and_offset(sb, blocks[i], &ent->ee_group,
+					     &ent->ee_offset);
+	}
+	job->aj_submitter = su;
+	job->aj_count = ea.ea_count;
+	job->aj_flags = ea.ea_flags & EXT4_EVFS_DURABLE_FLAGS;
+	if (ea.ea_flags & EXT4_EVFS_BATCH_SET)
+		job->aj_mode = EXT4_EVFS_SET;
+	else if (ea.ea_flags & EXT4_EVFS_BATCH_CLEAR)
+		job->aj_mode = EXT4_EVFS_CLEAR;
+	else
+		job->aj_mode = EXT4_EVFS_FLIP;
+	if (ea.ea_eventfd >= 0) {
+		job->aj_eventfd = eventfd_ctx_fdget(ea.ea_eventfd);
+		if (IS_ERR(job->aj_eventfd)) {
+			err = PTR_ERR(job->aj_eventfd);
+			job->aj_eventfd = NULL;
+			goto out_free;
+		}
+	}
+
+	err = -EAGAIN;
+	if (atomic_inc_return(&su->su_nr_tickets) > EXT4_EVFS_MAX_TICKETS)
+		goto out_count;
+	err = ext4_evfs_want_write(filp);
+	if (err)
+		goto out_count;
+	err = xa_alloc_cyclic(&su->su_tickets, &job->aj_ticket, job,
+			      xa_limit_32b, &su->su_next_ticket, GFP_KERNEL);
+	if (err < 0)
+		goto out_write;
+	if (put_user(job->aj_ticket, &uarg->ea_ticket)) {
+		xa_erase(&su->su_tickets, job->aj_ticket);
+		err = -EFAULT;
+		goto out_write;
+	}
+
+	job->aj_file = get_file(filp);
+	spin_lock(&ei->ei_async_lock);
+	list_add_tail(&job->aj_list, &ei->ei_async_queue);
+	spin_unlock(&ei->ei_async_lock);
+	queue_work(ei->ei_async_wq, &ei->ei_async_work);
+	kvfree(blocks);
+	return 0;
+
+out_write:
+	mnt_drop_write_file(filp);
+out_count:
+	atomic_dec(&su->su_nr_tickets);
+out_free:
+	if (job) {
+		if (job->aj_eventfd)
+			eventfd_ctx_put(job->aj_eventfd);
+		kvfree(job->aj_ents);
+	}
+	kfree(job);
+	kvfree(blocks);
+	return err;
+}
+
+/* Is @ticket done, or gone because another thread collected it? */
+static bool ext4_evfs_ticket_ready(struct ext4_evfs_submitter *su,
+				   u32 ticket)
+{
+	struct ext4_evfs_async_job *job;
+	bool ready;
+
+	// collectors erase under the same lock before freeing
+	xa_lock(&su->su_tickets);
+	job = xa_load(&su->su_tickets, ticket);
+	ready = !job || smp_load_acquire(&job->aj_done);
+	xa_unlock(&su->su_tickets);
+	return ready;
+}
+
+static long ext4_evfs_submitter_wait(struct ext4_evfs_submitter *su,
+				     unsigned long arg)
+{
+	struct ext4_evfs_wait __user *uarg = (void __user *)arg;
+	struct ext4_evfs_info *ei = su->su_ei;
+	struct ext4_evfs_async_job *job;
+	struct ext4_evfs_wait ew;
+	int err;
+
+	if (copy_from_user(&ew, uarg, sizeof(ew)))
+		return -EFAULT;
+	if ((ew.ew_flags & ~EXT4_EVFS_WAIT_NOWAIT) || ew.ew_ticket > U32_MAX)
+		return -EINVAL;
+
+	if (ew.ew_flags & EXT4_EVFS_WAIT_NOWAIT) {
+		if (!ext4_evfs_ticket_ready(su, ew.ew_ticket))
+			return -EAGAIN;
+	} else {
+		err = wait_event_interruptible(ei->ei_async_wait,
+				ext4_evfs_ticket_ready(su, ew.ew_ticket));
+		if (err)
+			return err;
+	}
+
+	job = xa_erase(&su->su_tickets, ew.ew_ticket);
+	if (!job)
+		return -ENOENT;
+
+	atomic_dec(&su->su_nr_tickets);
+	ew.ew_result = job->aj_result;
+	ew.ew_tid = job->aj_tid;
+	kfree(job);
+	if (copy_to_user(uarg, &ew, sizeof(ew)))
+		return -EFAULT;
+	return 0;
+}
+
+static long ext4_evfs_submitter_ioctl(struct file *file, unsigned int cmd,
+				      unsigned long arg)
+{
+	struct ext4_evfs_submitter *su = file->private_data;
+
+	switch (cmd) {
+	case EXT4_IOC_SUBMIT_BLOCK_BITS:
+		return ext4_evfs_submitter_submit(su, arg);
+	case EXT4_IOC_WAIT_TICKET:
+		return ext4_evfs_submitter_wait(su, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/* Has the worker finished with every job @su still has a ticket for? */
+static bool ext4_evfs_submitter_idle(struct ext4_evfs_submitter *su)
+{
+	struct ext4_evfs_async_job *job;
+	unsigned long ticket;
+
+	xa_for_each(&su->su_tickets, ticket, job)
+		if (!smp_load_acquire(&job->aj_done))
+			return false;
+	return true;
+}
+
+static int ext4_evfs_submitter_release(struct inode *inode, struct file *file)
+{
+	struct ext4_evfs_submitter *su = file->private_data;
+	struct ext4_evfs_info *ei = su->su_ei;
+	struct ext4_evfs_async_job *job, *tmp;
+	unsigned long ticket;
+	LIST_HEAD(cancelled);
+
+	spin_lock(&ei->ei_async_lock);
+	list_for_each_entry_safe(job, tmp, &ei->ei_async_queue, aj_list)
+		if (job->aj_submitter == su)
+			list_move_tail(&job->aj_list, &cancelled);
+	spin_unlock(&ei->ei_async_lock);
+	list_for_each_entry_safe(job, tmp, &cancelled, aj_list) {
+		list_del(&job->aj_list);
+		ext4_evfs_async_complete(ei, job, -ECANCELED, 0);
+	}
+	// the rest are being applied and can't be stopped part way
+	wait_event(ei->ei_async_wait, ext4_evfs_submitter_idle(su));
+
+	xa_for_each(&su->su_tickets, ticket, job)
+		kfree(job);
+	xa_destroy(&su->su_tickets);
+	ext4_evfs_info_put(ei);
+	fput(su->su_file);
+	kfree(su);
+	return 0;
+}
+
+static const struct file_operations ext4_evfs_submitter_fops = {
+	.unlocked_ioctl	= ext4_evfs_submitter_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.release	= ext4_evfs_submitter_release,
+	.llseek		= noop_llseek,
+};
+
+static long ext4_evfs_ioctl_open_submitter(struct file *filp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_submitter *su;
+	struct ext4_evfs_info *ei;
+	int fd, err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	ei = ext4_evfs_info(sb);
+
+	// only submitters queue work, so the worker is set up for the first
+	mutex_lock(&ext4_evfs_setup_lock);
+	if (!ei->ei_async_wq)
+		ei->ei_async_wq = alloc_ordered_workqueue("ext4-evfs-%s",
+						WQ_MEM_RECLAIM, sb->s_id);
+	mutex_unlock(&ext4_evfs_setup_lock);
+	if (!ei->ei_async_wq)
+		return -ENOMEM;
+
+	su = kzalloc(sizeof(*su), GFP_KERNEL);
+	if (!su)
+		return -ENOMEM;
+	xa_init_flags(&su->su_tickets, XA_FLAGS_ALLOC1);
+	su->su_ei = ext4_evfs_info_hold(ei);
+	su->su_file = get_file(filp);
+
+	fd = anon_inode_getfd("[ext4-evfs-submitter]",
+			      &ext4_evfs_submitter_fops, su,
+			      O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ext4_evfs_info_put(ei);
+		fput(su->su_file);
+		kfree(su);
+	}
+	return fd;
+}
+
+/*
+ * Sessions. Calls on a session fd are checked and queued; the commit
+ * runs them all, in order, under a single handle, so they land in one
+ * transaction. A handle can't be held open between calls without stalling
+ * every commit on the filesystem, so the reservation is only taken then.
+ *
+ * The commit reads and gets journal access to every group the session
+ * touches, then locks them all, in group order, and holds them across
+ * checking the whole session and applying it. Nothing can change the
+ * bitmaps in between, so an op can't fail once the check has passed, and
+ * if the check fails nothing has changed. Commits of one filesystem are
+ * serialised, which keeps the order of their group locks from mattering,
+ * and a session is limited to EXT4_EVFS_GROUPS_PER_HANDLE groups.
+ */
+
+/*
+ * Credits for the commit of @nr groups, in ascending order: each group's
+ * own blocks and each distinct descriptor block, as ext4_evfs_window()
+ * counts them.
+ */
+static int ext4_evfs_session_credits(struct super_block *sb,
+				     struct ext4_evfs_info *ei,
+				     ext4_group_t *groups, unsigned int nr)
+{
+	int credits = nr * (1 + ext4_evfs_track_credits(ei));
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		if (!i || groups[i] / EXT4_DESC_PER_BLOCK(sb) !=
+			  groups[i - 1] / EXT4_DESC_PER_BLOCK(sb))
+			credits++;
+	return credits;
+}
+
+/* Add @group to the sorted @groups unless it is there; -E2BIG if full */
+static int ext4_evfs_session_add_group(ext4_group_t *groups,
+				       unsigned int *nr, ext4_group_t group)
+{
+	unsigned int i;
+
+	for (i = 0; i < *nr && groups[i] < group; i++)
+		;
+	if (i < *nr && groups[i] == group)
+		return 0;
+	if (*nr == EXT4_EVFS_GROUPS_PER_HANDLE)
+		return -E2BIG;
+	memmove(&groups[i + 1], &groups[i], (*nr - i) * sizeof(*groups));
+	groups[i] = group;
+	(*nr)++;
+	return 0;
+}
+
+static void ext4_evfs_session_free_op(struct ext4_evfs_session_op *op)
+{
+	kvfree(op->so_ents);
+	kfree(op);
+}
+
+static void ext4_evfs_session_drop(struct ext4_evfs_session *es)
+{
+	struct ext4_evfs_session_op *op, *tmp;
+
+	list_for_each_entry_safe(op, tmp, &es->es_ops, so_list) {
+		list_del(&op->so_list);
+		ext4_evfs_session_free_op(op);
+	}
+	es->es_bits = 0;
+	es->es_nr_groups = 0;
+}
+
+/* Queue @count sorted entries covering @bits bits; takes over @ents */
+static int ext4_evfs_session_add(struct ext4_evfs_session *es,
+				 struct super_block *sb, int mode,
+				 struct ext4_evfs_entry *ents, u32 count,
+				 u64 bits)
+{
+	struct ext4_evfs_info *ei = ext4_evfs_info(sb);
+	ext4_group_t groups[EXT4_EVFS_GROUPS_PER_HANDLE];
+	struct ext4_evfs_session_op *op;
+	unsigned int nr;
+	int err = 0;
+	u32 i;
+
+	op = kzalloc(sizeof(*op), GFP_KERNEL);
+	if (!op) {
+		kvfree(ents);
+		return -ENOMEM;
+	}
+	op->so_mode = mode;
+	op->so_count = count;
+	op->so_ents = ents;
+
+	mutex_lock(&es->es_lock);
+	nr = es->es_nr_groups;
+	memcpy(groups, es->es_groups, nr * sizeof(*groups));
+	for (i = 0; !err && i < count; i++)
+		if (!i || ents[i].ee_group != ents[i - 1].ee_group)
+			err = ext4_evfs_session_add_group(groups, &nr,
+							  ents[i].ee_group);
+	if (!err && (es->es_bits + bits > EXT4_EVFS_MAX_BITS ||
+		     ext4_evfs_session_credits(sb, ei, groups, nr) >
+		     ext4_evfs_max_credits(sb)))
+		err = -E2BIG;
+	if (!err) {
+		list_add_tail(&op->so_list, &es->es_ops);
+		es->es_bits += bits;
+		memcpy(es->es_groups, groups, nr * sizeof(*groups));
+		es->es_nr_groups = nr;
+	}
+	mutex_unlock(&es->es_lock);
+	if (err)
+		ext4_evfs_session_free_op(op);
+	return err;
+}
+
+static long ext4_evfs_session_batch(struct ext4_evfs_session *es,
+				    unsigned long arg)
+{
+	struct super_block *sb = file_inode(es->es_file)->i_sb;
+	struct ext4_evfs_batch batch;
+	struct ext4_evfs_entry *ents = NULL;
+	int mode = EXT4_EVFS_FLIP;
+	__u64 *blocks;
+	u32 i;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+		return -EFAULT;
+	if ((batch.eb_flags & ~(EXT4_EVFS_BATCH_SET | EXT4_EVFS_BATCH_CLEAR)) ||
+	    (batch.eb_flags & EXT4_EVFS_BATCH_SET &&
+	     batch.eb_flags & EXT4_EVFS_BATCH_CLEAR) ||
+	    batch.eb_status || batch.eb_prior ||
+	    !batch.eb_count || batch.eb_count > EXT4_EVFS_MAX_BATCH)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	if (batch.eb_flags & EXT4_EVFS_BATCH_SET)
+		mode = EXT4_EVFS_SET;
+	else if (batch.eb_flags & EXT4_EVFS_BATCH_CLEAR)
+		mode = EXT4_EVFS_CLEAR;
+
+	blocks = kvmalloc_array(batch.eb_count, sizeof(*blocks), GFP_KERNEL);
+	ents = kvmalloc_array(batch.eb_count, sizeof(*ents), GFP_KERNEL);
+	if (!blocks || !ents) {
+		err = -ENOMEM;
+		goto out;
+	}
+	if (copy_from_user(blocks, u64_to_user_ptr(batch.eb_blocks),
+			   batch.eb_count * sizeof(*blocks))) {
+		err = -EFAULT;
+		goto out;
+	}
+	for (i = 0; i < batch.eb_count; i++) {
+		if (!ext4_evfs_block_valid(sb, blocks[i])) {
+			err = -EINVAL;
+			goto out;
+		}
+		ents[i].ee_block = blocks[i];
+		ents[i].ee_idx = i;
+		ents[i].ee_len = 1;
+		ext4_get_group_no_and_offset(sb, blocks[i], &ents[i].ee_group,
+					     &ents[i].ee_offset);
+	}
+	sort(ents, batch.eb_count, sizeof(*ents), ext4_evfs_entry_cmp, NULL);
+
+	err = ext4_evfs_session_add(es, sb, mode, ents, batch.eb_count,
+				    batch.eb_count);
+	ents = NULL;
+out:
+	kvfree(ents);
+	kvfree(blocks);
+	return err;
+}
+
+static long ext4_evfs_session_range(struct ext4_evfs_session *es,
+				    unsigned long arg, int mode)
+{
+	struct super_block *sb = file_inode(es->es_file)->i_sb;
+	struct ext4_evfs_range range;
+	struct ext4_evfs_entry *ents;
+	u32 nr;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&range, (void __user *)arg, sizeof(range)))
+		return -EFAULT;
+	if (range.er_flags || range.er_pad || range.er_prior)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	if (!range.er_len ||
+	    range.er_start + range.er_len < range.er_start ||
+	    !ext4_evfs_block_valid(sb, range.er_start) ||
+	    !ext4_evfs_block_valid(sb, range.er_start + range.er_len - 1))
+		return -EINVAL;
+	if (range.er_len > EXT4_EVFS_MAX_BITS)
+		return -E2BIG;
+
+	nr = ext4_evfs_split_range(sb, range.er_start, range.er_len, &ents);
+	if (!nr)
+		return -ENOMEM;
+	return ext4_evfs_session_add(es, sb, mode, ents, nr, range.er_len);
+}
+
+/*
+ * Check one entry as ext4_evfs_apply() would, against @bm and @claims,
+ * the group's bits and EVFS claims as the ops before it leave them, and
+ * make its change to them. @eg has the group's on-disk bitmap and buddy.
+ */
+static int ext4_evfs_session_check_ent(struct ext4_evfs_group *eg, int mode,
+				       void *bm, struct ext4_evfs_track *claims,
+				       struct ext4_evfs_entry *ent, u64 *claim)
+{
+	int cur = ent->ee_offset, end = ent->ee_offset + ent->ee_len;
+	int next;
+	bool set;
+
+	if (mode == EXT4_EVFS_FLIP)
+		set = !ext4_test_bit(ent->ee_offset, bm);
+	else
+		set = mode == EXT4_EVFS_SET;
+	if (!set) {
+		if (!ext4_evfs_track_covers(claims, bm, ent->ee_offset,
+					    ent->ee_len))
+			return -EPERM;
+		ext4_evfs_clear_bits(claims->et_bitmap, cur, ent->ee_len);
+		ext4_evfs_clear_bits(bm, cur, ent->ee_len);
+		return 0;
+	}
+	if (ext4_evfs_buddy_busy(eg, ent))
+		return -EBUSY;
+	// only the bits that were free become claims
+	for (; cur < end; cur = next) {
+		cur = ext4_find_next_zero_bit(bm, end, cur);
+		if (cur >= end)
+			break;
+		next = ext4_find_next_bit(bm, end, cur);
+		mb_set_bits(claims->et_bitmap, cur, next - cur);
+	}
+	*claim += ent->ee_len - ext4_evfs_set_bits(bm, ent->ee_offset,
+						   ent->ee_len);
+	return 0;
+}
+
+/*
+ * Lock the buddy pages and then the group locks of all @nr groups, in
+ * group order. With small blocks neighbouring groups share a page, which
+ * is locked once, for the first of them; group locks are hashed, so one
+ * may cover several groups and is also taken only once.
+ */
+static void ext4_evfs_session_lock(struct super_block *sb,
+				   struct ext4_evfs_info *ei,
+				   struct ext4_evfs_group *egs, unsigned int nr)
+{
+	int blocks_per_page = PAGE_SIZE / sb->s_blocksize;
+	unsigned int i, j;
+
+	for (i = 0; i < nr; i++) {
+		struct ext4_buddy *e4b = &egs[i].eg_buddy;
+
+		egs[i].eg_buddy_shared = i && blocks_per_page > 2 &&
+			egs[i].eg_group * 2 / blocks_per_page ==
+			egs[i - 1].eg_group * 2 / blocks_per_page;
+		if (!egs[i].eg_buddy_shared) {
+			ext4_evfs_buddy_lock_pages(sb, egs[i].eg_group, e4b);
+			continue;
+		}
+		*e4b = egs[i - 1].eg_buddy;
+		e4b->bd_group = egs[i].eg_group;
+		e4b->bd_info = ext4_get_group_info(sb, egs[i].eg_group);
+	}
+	for (i = 0; i < nr; i++) {
+		spinlock_t *lock = ext4_group_lock_ptr(sb, egs[i].eg_group);
+
+		for (j = 0; j < i; j++)
+			if (ext4_group_lock_ptr(sb, egs[j].eg_group) == lock)
+				break;
+		if (j == i)
+			spin_lock_nest_lock(lock, &ei->ei_session_lock);
+	}
+}
+
+static void ext4_evfs_session_unlock(struct super_block *sb,
+				     struct ext4_evfs_group *egs,
+				     unsigned int nr)
+{
+	unsigned int i, j;
+
+	for (i = nr; i-- > 0; ) {
+		spinlock_t *lock = ext4_group_lock_ptr(sb, egs[i].eg_group);
+
+		for (j = 0; j < i; j++)
+			if (ext4_group_lock_ptr(sb, egs[j].eg_group) == lock)
+				break;
+		if (j == i)
+			spin_unlock(lock);
+	}
+	for (i = nr; i-- > 0; ) {
+		if (egs[i].eg_buddy_shared)
+			memset(&egs[i].eg_buddy, 0, sizeof(egs[i].eg_buddy));
+		else
+			ext4_evfs_buddy_unlock_pages(&egs[i].eg_buddy);
+	}
+}
+
+/*
+ * Check the whole session, with all its groups locked and marked for
+ * change: one group at a time, every op's entries in the group, in order,
+ * on a copy of its bits and claims, so that an op may clear what an
+ * earlier one set. Fails with -EPERM or -EBUSY as the first bad entry
+ * would have. Otherwise the clusters the session sets are claimed, into
+ * @reserved, or it fails with -ENOSPC; clusters it frees along the way
+ * don't count towards them. @bm and @claims are scratch.
+ */
+static int ext4_evfs_session_check(struct super_block *sb,
+				   struct ext4_evfs_session *es,
+				   struct ext4_evfs_group *egs, void *bm,
+				   struct ext4_evfs_track *claims,
+				   u64 *reserved)
+{
+	struct ext4_evfs_session_op *op;
+	unsigned int i;
+	u64 claim = 0;
+	int err = 0;
+
+	list_for_each_entry(op, &es->es_ops, so_list)
+		op->so_next = 0;
+	for (i = 0; !err && i < es->es_nr_groups; i++) {
+		struct ext4_evfs_group *eg = &egs[i];
+
+		memcpy(bm, eg->eg_bitmap_bh->b_data, sb->s_blocksize);
+		ext4_evfs_track_copy(eg->eg_track, claims->et_bitmap,
+				     sb->s_blocksize);
+		list_for_each_entry(op, &es->es_ops, so_list) {
+			struct ext4_evfs_entry *ent;
+
+			for (; !err && op->so_next < op->so_count;
+			     op->so_next++) {
+				ent = &op->so_ents[op->so_next];
+				if (ent->ee_group != eg->eg_group)
+					break;
+				err = ext4_evfs_session_check_ent(eg,
+						op->so_mode, bm, claims, ent,
+						&claim);
+			}
+		}
+	}
+	if (!err && claim &&
+	    ext4_claim_free_clusters(EXT4_SB(sb), claim, 0))
+		err = -ENOSPC;
+	if (!err)
+		*reserved = claim;
+	return err;
+}
+
+/* Apply one op to the locked, checked @egs; it can't fail by now */
+static void ext4_evfs_session_apply(struct super_block *sb,
+				    struct ext4_evfs_session *es,
+				    struct ext4_evfs_session_op *op,
+				    struct ext4_evfs_group *egs,
+				    u64 *reserved)
+{
+	struct ext4_evfs_req req = {
+		.rq_mode = op->so_mode,
+		.rq_ents = op->so_ents,
+		.rq_count = op->so_count,
+		.rq_reserved = *reserved,
+	};
+	unsigned int g = 0;
+	u32 i;
+
+	ext4_evfs_stat_op(es->es_ei, EXT4_EVFS_OP_BLOCK + op->so_mode);
+	for (i = 0; i < op->so_count; i++) {
+		while (egs[g].eg_group != op->so_ents[i].ee_group)
+			g++;
+		WARN_ON_ONCE(ext4_evfs_apply(sb, &req, &egs[g],
+					     &op->so_ents[i]) < 0);
+	}
+	*reserved = req.rq_reserved;
+}
+
+/*
+ * Read every group of the session and take its locks, with each group's
+ * tracker ready for the runs @new_runs[] it may gain, and its buddy
+ * marked for change. -EBUSY if mballoc is using one.
+ */
+static int ext4_evfs_session_begin(handle_t *handle, struct super_block *sb,
+				   struct ext4_evfs_session *es,
+				   struct ext4_evfs_group *egs,
+				   unsigned int *new_runs)
+{
+	struct ext4_evfs_info *ei = es->es_ei;
+	struct ext4_evfs_session_op *op;
+	unsigned int i, nr = es->es_nr_groups;
+	int err;
+
+	for (i = 0; i < nr; i++) {
+		bool claim = false;
+
+		// each run of changed bits adds at most one tracked run
+		new_runs[i] = 0;
+		list_for_each_entry(op, &es->es_ops, so_list) {
+			struct ext4_evfs_entry *ent;
+
+			for (; op->so_next < op->so_count; op->so_next++) {
+				ent = &op->so_ents[op->so_next];
+				if (ent->ee_group != es->es_groups[i])
+					break;
+				new_runs[i] += (ent->ee_len + 1) / 2;
+				claim |= op->so_mode != EXT4_EVFS_CLEAR;
+			}
+		}
+		err = ext4_evfs_group_read(handle, sb, ei, es->es_groups[i],
+					   claim, &egs[i]);
+		if (err) {
+			while (i-- > 0)
+				ext4_evfs_group_release(&egs[i]);
+			return err;
+		}
+	}
+
+	for (;;) {
+		ext4_evfs_session_lock(sb, ei, egs, nr);
+		for (i = 0; i < nr; i++)
+			if (!ext4_evfs_track_ready(ei, &egs[i], new_runs[i]))
+				break;
+		if (i == nr)
+			break;
+		ext4_evfs_session_unlock(sb, egs, nr);
+		for (; i < nr; i++) {
+			err = ext4_evfs_track_prepare(handle, ei, &egs[i],
+						      new_runs[i]);
+			if (err)
+				goto out;
+		}
+	}
+
+	// all are attached before a shared page is marked out of date
+	for (i = 0; i < nr; i++)
+		ext4_evfs_buddy_attach(&egs[i]);
+	for (i = 0; i < nr; i++) {
+		err = ext4_evfs_buddy_invalidate(&egs[i]);
+		if (err) {
+			ext4_evfs_session_unlock(sb, egs, nr);
+			goto out;
+		}
+	}
+	return 0;
+
+out:
+	for (i = 0; i < nr; i++)
+		ext4_evfs_group_release(&egs[i]);
+	return err;
+}
+
+/*
+ * Apply the session with all its groups locked, or fail with nothing
+ * changed. Returns the bits changed in @changed and the transaction in
+ * @tid.
+ */
+static int ext4_evfs_session_run(struct super_block *sb,
+				 struct ext4_evfs_session *es,
+				 u64 *changed, tid_t *tid)
+{
+	struct ext4_evfs_info *ei = es->es_ei;
+	unsigned int new_runs[EXT4_EVFS_GROUPS_PER_HANDLE];
+	struct ext4_evfs_track claims = { 0 };
+	struct ext4_evfs_session_op *op;
+	struct ext4_evfs_flex ef = { 0 };
+	struct ext4_evfs_group *egs;
+	unsigned int i, nr = es->es_nr_groups;
+	handle_t *handle;
+	u64 reserved = 0;
+	void *bm;
+	int err, err2;
+
+	egs = kvcalloc(nr, sizeof(*egs), GFP_KERNEL);
+	bm = kmalloc(sb->s_blocksize, GFP_NOFS);
+	claims.et_bitmap = kmalloc(sb->s_blocksize, GFP_NOFS);
+	if (!egs || !bm || !claims.et_bitmap) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+	// taken before the handle, so no commit waits on one that waits
+	mutex_lock(&ei->ei_session_lock);
+	handle = ext4_journal_start_sb(sb, EXT4_HT_MISC,
+			ext4_evfs_session_credits(sb, ei, es->es_groups, nr));
+	if (IS_ERR(handle)) {
+		err = PTR_ERR(handle);
+		mutex_unlock(&ei->ei_session_lock);
+		goto out_free;
+	}
+	ext4_evfs_fc_ineligible(sb, handle);
+
+	list_for_each_entry(op, &es->es_ops, so_list)
+		op->so_next = 0;
+	err = ext4_evfs_session_begin(handle, sb, es, egs, new_runs);
+	if (err)
+		goto out_unlock;
+	err = ext4_evfs_session_check(sb, es, egs, bm, &claims, &reserved);
+	if (err) {
+		ext4_evfs_session_unlock(sb, egs, nr);
+		for (i = 0; i < nr; i++)
+			ext4_evfs_group_release(&egs[i]);
+		goto out_unlock;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ext4_evfs_group_stats_note(egs[i].eg_stats);
+		ext4_evfs_group_init_desc(sb, &egs[i]);
+	}
+	list_for_each_entry(op, &es->es_ops, so_list)
+		ext4_evfs_session_apply(sb, es, op, egs, &reserved);
+	for (i = 0; i < nr; i++)
+		ext4_evfs_group_settle(sb, ei, &egs[i]);
+	ext4_evfs_session_unlock(sb, egs, nr);
+
+	for (i = 0; i < nr; i++) {
+		err2 = ext4_evfs_group_dirty(handle, sb, ei, &egs[i]);
+		if (!err)
+			err = err2;
+		*changed += egs[i].eg_changed;
+		ext4_evfs_flex_add(sb, &ef, egs[i].eg_group,
+				   egs[i].eg_free_delta);
+	}
+	ext4_evfs_flex_flush(sb, &ef);
+	// what the check claimed and nothing went on to set
+	if (reserved)
+		percpu_counter_sub(&EXT4_SB(sb)->s_dirtyclusters_counter,
+				   reserved);
+out_unlock:
+	if (ext4_handle_valid(handle))
+		*tid = handle->h_transaction->t_tid;
+	err2 = ext4_journal_stop(handle);
+	if (!err)
+		err = err2;
+	mutex_unlock(&ei->ei_session_lock);
+out_free:
+	if (err)
+		ext4_evfs_stat_error(ei, err);
+	kfree(claims.et_bitmap);
+	kfree(bm);
+	kvfree(egs);
+	return err;
+}
+
+static long ext4_evfs_session_commit(struct ext4_evfs_session *es,
+				     unsigned long arg)
+{
+	struct super_block *sb = file_inode(es->es_file)->i_sb;
+	struct ext4_evfs_commit __user *uarg = (void __user *)arg;
+	struct ext4_evfs_commit ec;
+	tid_t tid = 0;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&ec, uarg, sizeof(ec)))
+		return -EFAULT;
+	if ((ec.ec_flags & ~EXT4_EVFS_DURABLE_FLAGS) || ec.ec_pad)
+		return -EINVAL;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	ec.ec_changed = 0;
+
+	mutex_lock(&es->es_lock);
+	if (list_empty(&es->es_ops))
+		goto out;
+	err = ext4_evfs_want_write(es->es_file);
+	if (err)
+		goto out;
+	err = ext4_evfs_session_run(sb, es, &ec.ec_changed, &tid);
+	mnt_drop_write_file(es->es_file);
+	if (!err && ec.ec_changed)
+		err = ext4_evfs_durable(sb, tid, ec.ec_flags);
+out:
+	// committed or not, the queue is spent
+	ext4_evfs_session_drop(es);
+	mutex_unlock(&es->es_lock);
+	if (!err && copy_to_user(uarg, &ec, sizeof(ec)))
+		err = -EFAULT;
+	return err;
+}
+
+static long ext4_evfs_session_ioctl(struct file *file, unsigned int cmd,
+				    unsigned long arg)
+{
+	struct ext4_evfs_session *es = file->private_data;
+
+	switch (cmd) {
+	case EXT4_IOC_FLIP_BLOCK_BITS:
+		return ext4_evfs_session_batch(es, arg);
+	case EXT4_IOC_SET_BLOCK_RANGE:
+		return ext4_evfs_session_range(es, arg, EXT4_EVFS_SET);
+	case EXT4_IOC_CLEAR_BLOCK_RANGE:
+		return ext4_evfs_session_range(es, arg, EXT4_EVFS_CLEAR);
+	case EXT4_IOC_SESSION_COMMIT:
+		return ext4_evfs_session_commit(es, arg);
+	case EXT4_IOC_SESSION_ABORT:
+		mutex_lock(&es->es_lock);
+		ext4_evfs_session_drop(es);
+		mutex_unlock(&es->es_lock);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int ext4_evfs_session_release(struct inode *inode, struct file *file)
+{
+	struct ext4_evfs_session *es = file->private_data;
+
+	ext4_evfs_session_drop(es);
+	ext4_evfs_info_put(es->es_ei);
+	fput(es->es_file);
+	kfree(es);
+	return 0;
+}
+
+static const struct file_operations ext4_evfs_session_fops = {
+	.unlocked_ioctl	= ext4_evfs_session_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.release	= ext4_evfs_session_release,
+	.llseek		= noop_llseek,
+};
+
+static long ext4_evfs_ioctl_open_session(struct file *filp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct ext4_evfs_session *es;
+	int fd, err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	err = ext4_evfs_check_sb(sb, true);
+	if (err)
+		return err;
+	es = kzalloc(sizeof(*es), GFP_KERNEL);
+	if (!es)
+		return -ENOMEM;
+	mutex_init(&es->es_lock);
+	INIT_LIST_HEAD(&es->es_ops);
+	es->es_ei = ext4_evfs_info_hold(ext4_evfs_info(sb));
+	es->es_file = get_file(filp);
+
+	fd = anon_inode_getfd("[ext4-evfs-session]", &ext4_evfs_session_fops,
+			      es, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ext4_evfs_info_put(es->es_ei);
+		fput(es->es_file);
+		kfree(es);
+	}
+	return fd;
+}
+
+/*
+ * IORING_OP_URING_CMD entry point of the command fd. The EVFS ops all
+ * read bitmaps and most wait on a journal handle, so they never run
+ * inline: a non-blocking issue is bounced to io-wq, where the op runs
+ * exactly as the ioctl would on the file the fd was opened from, and
+ * completes with its result once its handle has been stopped.
+ */
+static int ext4_evfs_cmd_uring_cmd(struct io_uring_cmd *ioucmd,
+				   unsigned int issue_flags)
+{
+	struct file *filp = ioucmd->file->private_data;
+
+	switch (ioucmd->cmd_op) {
+	case EXT4_IOC_FLIP_BLOCK_BIT:
+	case EXT4_IOC_FLIP_BLOCK_BITS:
+	case EXT4_IOC_SET_BLOCK_RANGE:
+	case EXT4_IOC_CLEAR_BLOCK_RANGE:
+	case EXT4_IOC_GET_BLOCK_BITS:
+	case EXT4_IOC_FLIP_INODE_BIT:
+	case EXT4_IOC_FLIP_INODE_BITS:
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+	return __ext4_evfs_ioctl(filp, ioucmd->cmd_op,
+				 READ_ONCE(ioucmd->sqe->addr));
+}
+
+static int ext4_evfs_cmd_release(struct inode *inode, struct file *file)
+{
+	fput(file->private_data);
+	return 0;
+}
+
+static const struct file_operations ext4_evfs_cmd_fops = {
+	.uring_cmd	= ext4_evfs_cmd_uring_cmd,
+	.release	= ext4_evfs_cmd_release,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Hand out an fd to queue EVFS ops on through io_uring. It pins @filp,
+ * which the ops run against with its mount and open mode, so they need
+ * the same access as the ioctls do.
+ */
+static long ext4_evfs_ioctl_open_cmd_fd(struct file *filp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	int fd, err;
+
+	err = ext4_evfs_check_sb(sb, false);
+	if (err)
 		return err;
+	fd = anon_inode_getfd("[ext4-evfs-cmd]", &ext4_evfs_cmd_fops,
+			      get_file(filp), O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		fput(filp);
+	return fd;
+}
+
+static long ext4_evfs_ioctl(struct file *filp, unsigned int cmd,
+			    unsigned long arg)
+{
+	switch (cmd) {
+	case EXT4_IOC_FLIP_BLOCK_BIT:
+		return ext4_evfs_ioctl_flip_block(filp, arg);
+	case EXT4_IOC_FLIP_BLOCK_BITS:
+		return ext4_evfs_ioctl_flip_batch(filp, arg, false);
+	case EXT4_IOC_SET_BLOCK_RANGE:
+		return ext4_evfs_ioctl_range(filp, arg, EXT4_EVFS_SET);
+	case EXT4_IOC_CLEAR_BLOCK_RANGE:
+		return ext4_evfs_ioctl_range(filp, arg, EXT4_EVFS_CLEAR);
+	case EXT4_IOC_GET_BLOCK_BITS:
+		return ext4_evfs_ioctl_get_bits(filp, arg);
+	case EXT4_IOC_MAP_BLOCK_BITMAP:
+		return ext4_evfs_ioctl_map_bitmap(filp);
+	case EXT4_IOC_CREATE_TRACKER:
+		return ext4_evfs_ioctl_create_tracker(filp);
+	case EXT4_IOC_FLIP_INODE_BIT:
+		return ext4_evfs_ioctl_flip_inode(filp, arg);
+	case EXT4_IOC_FLIP_INODE_BITS:
+		return ext4_evfs_ioctl_flip_batch(filp, arg, true);
+	case EXT4_IOC_OPEN_SUBMITTER:
+		return ext4_evfs_ioctl_open_submitter(filp);
+	case EXT4_IOC_OPEN_SESSION:
+		return ext4_evfs_ioctl_open_session(filp);
+	default:
+		return -ENOTTY;
+	}
 }
-    default:
-        return -ENOTTY;
-    }
-}
\ No newline at end of file
+
+long __ext4_evfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct ext4_evfs_info *ei;
+	long ret;
+
+	switch (cmd) {
+	case EXT4_IOC32_PRINTHELLO:
+		pr_info("ext4: HELLO\n");
+		return 0;
+	case EXT4_IOC_OPEN_CMD_FD:
+		// ops queued on it come back through here
+		return ext4_evfs_ioctl_open_cmd_fd(filp);
+	case EXT4_IOC_FLIP_BLOCK_BIT:
+	case EXT4_IOC_FLIP_BLOCK_BITS:
+	case EXT4_IOC_SET_BLOCK_RANGE:
+	case EXT4_IOC_CLEAR_BLOCK_RANGE:
+	case EXT4_IOC_GET_BLOCK_BITS:
+	case EXT4_IOC_MAP_BLOCK_BITMAP:
+	case EXT4_IOC_CREATE_TRACKER:
+	case EXT4_IOC_FLIP_INODE_BIT:
+	case EXT4_IOC_FLIP_INODE_BITS:
+	case EXT4_IOC_OPEN_SUBMITTER:
+	case EXT4_IOC_OPEN_SESSION:
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	// the state lives as long as a call or an fd is using it
+	ei = ext4_evfs_info_get(file_inode(filp)->i_sb);
+	if (IS_ERR(ei))
+		return PTR_ERR(ei);
+	ret = ext4_evfs_ioctl(filp, cmd, arg);
+	ext4_evfs_info_put(ei);
+	return ret;
+}
+
+#ifdef CONFIG_EXT4_KUNIT_TESTS
+#include "ext4-evfs-test.c"
+#endif
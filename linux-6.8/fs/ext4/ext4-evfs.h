@@ -1,3 +1,261 @@
+#ifndef _EXT4_EVFS_H
+#define _EXT4_EVFS_H
 
+#include <linux/types.h>
+#include <linux/ioctl.h>
 
-long __ext4_evfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
\ No newline at end of file
+struct file;
+struct super_block;
+
+/*
+ * Prior-state bitmaps returned by the calls below use the same layout as
+ * ext4's own bitmaps: bit i is bit (i % 8) of byte (i / 8).
+ *
+ * EVFS only gives back blocks it claimed itself: clearing a set bit that
+ * was not set through EVFS fails with EPERM and changes nothing. Setting
+ * bits claims their clusters as an allocation would: if that would dip
+ * into the reserved blocks or space promised to delayed allocation, the
+ * entry fails with ENOSPC and changes nothing. Setting a block mballoc
+ * has preallocated or is part way through allocating fails with EBUSY,
+ * as does any change to a group mballoc is allocating from at that
+ * moment; the latter is transient and worth a retry.
+ *
+ * Every call that can change a bitmap needs CAP_SYS_ADMIN; without it the
+ * call fails with EPERM before looking at its arguments.
+ */
+
+/*
+ * Vectored EXT4_IOC_FLIP_BLOCK_BIT. eb_blocks points at eb_count block
+ * numbers; on return eb_status[i] holds the new state of block i's bit
+ * (0 or 1) or a negative errno if that entry was rejected. If eb_prior is
+ * non-zero, bit i of that bitmap is set when block i's bit was set before
+ * the call touched it.
+ */
+struct ext4_evfs_batch {
+	__u64 eb_blocks;	/* user pointer to __u64[eb_count] */
+	__u64 eb_status;	/* user pointer to __s32[eb_count] */
+	__u64 eb_prior;		/* optional user pointer to eb_count bits */
+	__u32 eb_count;
+	__u32 eb_flags;		/* EXT4_EVFS_BATCH_* */
+};
+
+/* Set or clear the bits instead of flipping them; already-set bits stay */
+#define EXT4_EVFS_BATCH_SET		0x0001
+#define EXT4_EVFS_BATCH_CLEAR		0x0002
+/* EXT4_IOC_FLIP_INODE_BITS only: count inodes claimed as directories */
+#define EXT4_EVFS_BATCH_DIR		0x0004
+
+/*
+ * Durability, also taken in er_flags and ea_flags. By default a call
+ * returns once its changes are in the running journal transaction. With
+ * EXT4_EVFS_BATCH_COMMIT it returns once that transaction has committed;
+ * callers whose changes went into the same transaction share the one
+ * commit. EXT4_EVFS_BATCH_SYNC also makes sure the device has flushed
+ * its write cache. Without a journal both write the metadata out.
+ * Fast commits can't carry EVFS changes, so a transaction holding any
+ * commits in full even when the filesystem has fast_commit.
+ */
+#define EXT4_EVFS_BATCH_COMMIT		0x0008
+#define EXT4_EVFS_BATCH_SYNC		0x0010
+#define EXT4_EVFS_DURABLE_FLAGS		(EXT4_EVFS_BATCH_COMMIT | \
+					 EXT4_EVFS_BATCH_SYNC)
+
+#define EXT4_EVFS_BATCH_VALID_FLAGS	(EXT4_EVFS_BATCH_SET | \
+					 EXT4_EVFS_BATCH_CLEAR | \
+					 EXT4_EVFS_DURABLE_FLAGS)
+
+/*
+ * EXT4_IOC_FLIP_INODE_BIT and EXT4_IOC_FLIP_INODE_BITS do the same for
+ * inode bitmaps, taking inode numbers (in eb_blocks for the batch). The
+ * group's free inode, directory and unused inode table counts follow.
+ * Inodes claimed through EVFS are recorded like blocks (see below); only
+ * those can be freed again. Claiming an inode zeroes its inode table
+ * entry, so whatever was there before is never taken for a live inode.
+ */
+
+/*
+ * Set or clear every block bit in [er_start, er_start + er_len). Runs may
+ * cross block groups. er_changed returns how many bits actually changed
+ * state, and er_prior (if non-zero) receives er_len bits holding the
+ * range's state before the call.
+ */
+struct ext4_evfs_range {
+	__u64 er_start;
+	__u64 er_len;
+	__u64 er_changed;	/* out */
+	__u64 er_prior;		/* optional user pointer to er_len bits */
+	__u32 er_flags;		/* EXT4_EVFS_BATCH_COMMIT or _SYNC */
+	__u32 er_pad;
+};
+
+/*
+ * Read the allocation bits of [eq_start, eq_start + eq_len) on a mounted
+ * filesystem into the eq_len-bit buffer at eq_bits.
+ */
+struct ext4_evfs_query {
+	__u64 eq_start;
+	__u64 eq_len;
+	__u64 eq_bits;		/* user pointer to eq_len bits */
+	__u32 eq_flags;		/* must be zero */
+	__u32 eq_pad;
+};
+
+/*
+ * EXT4_IOC_MAP_BLOCK_BITMAP returns an fd that can be mmap()ed read-only.
+ * The mapping starts with this header; the filesystem's block bitmap
+ * follows at mh_bitmap_offset, one bit per block starting at
+ * mh_first_block, with groups of mh_bits_per_group bits back to back.
+ *
+ * mh_seq[g] is odd while group g's bits are being rewritten and changes
+ * whenever they have been. Read it, read the group's bits, then re-read
+ * it; if it was odd or has changed, retry.
+ *
+ * EVFS changes show up as they are made, but the block allocator doesn't
+ * touch the map or mh_seq, so its allocations and frees only show up, and
+ * the view is only current, as of the last EXT4_IOC_MAP_SYNC on the fd.
+ *
+ * Both calls need CAP_SYS_ADMIN. The mapping holds a bit per block of the
+ * whole filesystem; if that would be over 512MiB, the map can't be set up
+ * and EXT4_IOC_MAP_BLOCK_BITMAP fails with E2BIG.
+ */
+#define EXT4_EVFS_MAP_MAGIC	0x45564653	/* "EVFS" */
+
+struct ext4_evfs_map_header {
+	__u32 mh_magic;
+	__u32 mh_groups;
+	__u32 mh_bits_per_group;
+	__u32 mh_bitmap_offset;	/* bytes from the start of the mapping */
+	__u64 mh_size;		/* total size of the mapping */
+	__u64 mh_first_block;	/* block described by bit 0 */
+	__u64 mh_blocks;	/* blocks in the filesystem */
+	__u32 mh_seq[];		/* per-group sequence counters */
+};
+
+/*
+ * On disk, the blocks claimed through EVFS are recorded in an ordinary
+ * regular file, EXT4_EVFS_TRACK_NAME in the root directory, which e2fsck
+ * checks like any other. The first change creates it, or
+ * EXT4_IOC_CREATE_TRACKER does ahead of that; while the name is taken by
+ * something other than a regular file, changes fail with EEXIST.
+ * Removing the file forgets the claims in it.
+ *
+ * Like the orphan file, the file is a series of blocks each ending in a
+ * checksummed tail. Each group has three trackers, of the clusters, the
+ * inodes and, of those, the directories claimed in it. Tracker t of group
+ * g is block 2(3g + t): a sorted array of tt_nr_runs runs of claimed bits
+ * of the group's bitmap, or, with EXT4_EVFS_TRACK_BITMAP, a bitmap of
+ * them held in the block after. A hole means nothing is claimed. With
+ * metadata_csum, tt_checksum covers the block number, the runs in use,
+ * the bitmap block if any, and the rest of the tail.
+ */
+#define EXT4_EVFS_TRACK_NAME	".evfs-tracker"
+#define EXT4_EVFS_TRACK_MAGIC	0x45565452	/* "EVTR" */
+#define EXT4_EVFS_TRACK_BITMAP	0x0001
+
+#define EXT4_EVFS_TRACK_CLUSTERS	0
+#define EXT4_EVFS_TRACK_INODES		1
+#define EXT4_EVFS_TRACK_DIRS		2
+#define EXT4_EVFS_TRACK_KINDS		3
+
+struct ext4_evfs_track_disk_run {
+	__le32 dr_start;	/* first cluster, relative to the group */
+	__le32 dr_len;
+};
+
+struct ext4_evfs_track_tail {
+	__le32 tt_magic;
+	__le16 tt_flags;
+	__le16 tt_nr_runs;
+	__le32 tt_count;	/* bits claimed in the group */
+	__le32 tt_checksum;
+};
+
+/*
+ * EXT4_IOC_OPEN_SUBMITTER returns a submitter fd. EXT4_IOC_SUBMIT_BLOCK_BITS
+ * on it queues a flip of ea_count blocks (or, with EXT4_EVFS_BATCH_SET or
+ * _CLEAR, a set or clear) and returns at once with a ticket in ea_ticket.
+ * A per-filesystem worker applies submissions in order, running
+ * consecutive ones of the same kind as one operation. If ea_eventfd isn't
+ * -1, that eventfd is signalled once the blocks are done, and durable if
+ * ea_flags asked for it.
+ *
+ * EXT4_IOC_WAIT_TICKET on the same fd waits for ew_ticket to be done, or
+ * with EXT4_EVFS_WAIT_NOWAIT fails with EAGAIN if it isn't yet. It returns
+ * 0 or the submission's first error in ew_result, and in ew_tid the
+ * journal transaction that holds its changes. Tickets belong to the fd:
+ * each has to be collected through it, eventfd or not, and while too many
+ * are outstanding submission fails with EAGAIN. Closing the fd cancels
+ * what the worker hasn't started on, waits for the rest and drops every
+ * ticket left.
+ */
+struct ext4_evfs_async {
+	__u64 ea_blocks;	/* user pointer to __u64[ea_count] */
+	__u32 ea_count;
+	__u32 ea_flags;		/* EXT4_EVFS_BATCH_{SET,CLEAR,COMMIT,SYNC} */
+	__s32 ea_eventfd;	/* or -1 */
+	__u32 ea_pad;
+	__u64 ea_ticket;	/* out */
+};
+
+struct ext4_evfs_wait {
+	__u64 ew_ticket;
+	__u64 ew_tid;		/* out */
+	__s32 ew_result;	/* out */
+	__u32 ew_flags;		/* EXT4_EVFS_WAIT_* */
+};
+
+#define EXT4_EVFS_WAIT_NOWAIT		0x0001
+
+/*
+ * EXT4_IOC_OPEN_SESSION returns a session fd for changes that have to
+ * happen together. EXT4_IOC_FLIP_BLOCK_BITS (with or without _SET or
+ * _CLEAR), EXT4_IOC_SET_BLOCK_RANGE and EXT4_IOC_CLEAR_BLOCK_RANGE on it
+ * take the usual arguments but only check them and queue the change: an
+ * invalid block fails the whole call, and eb_status, eb_prior, er_prior
+ * and the durability flags must be zero.
+ *
+ * EXT4_IOC_SESSION_COMMIT applies everything queued, in order, in one
+ * journal transaction, and returns in ec_changed how many bits changed.
+ * It locks every block group the session touches against allocation
+ * while it checks the whole session and applies it, so either all of it
+ * happens or, with EPERM, EBUSY or ENOSPC as for the single calls,
+ * nothing does. The clusters it sets must be free without counting any
+ * it clears. EXT4_IOC_SESSION_ABORT, or closing the fd, drops the queue;
+ * so does a commit, whether it succeeded or not. A session touches at
+ * most 64 block groups, within what one transaction's share for EVFS can
+ * take; queueing beyond that fails with E2BIG.
+ */
+struct ext4_evfs_commit {
+	__u64 ec_changed;	/* out */
+	__u32 ec_flags;		/* EXT4_EVFS_BATCH_COMMIT or _SYNC */
+	__u32 ec_pad;
+};
+
+/*
+ * The flip, range and query ops above can also be queued through io_uring
+ * on the fd EXT4_IOC_OPEN_CMD_FD returns: an IORING_OP_URING_CMD SQE with
+ * cmd_op set to the ioctl number and addr pointing at the same argument as
+ * for ioctl(). The op runs against the file the fd was opened from. The
+ * argument must stay valid until the CQE arrives; its res is what the
+ * ioctl would have returned.
+ */
+#define EXT4_IOC_FLIP_BLOCK_BITS	_IOW('f', 101, struct ext4_evfs_batch)
+#define EXT4_IOC_SET_BLOCK_RANGE	_IOWR('f', 102, struct ext4_evfs_range)
+#define EXT4_IOC_CLEAR_BLOCK_RANGE	_IOWR('f', 103, struct ext4_evfs_range)
+#define EXT4_IOC_GET_BLOCK_BITS		_IOW('f', 104, struct ext4_evfs_query)
+#define EXT4_IOC_MAP_BLOCK_BITMAP	_IO('f', 105)
+#define EXT4_IOC_MAP_SYNC		_IO('f', 106)	/* on the map fd */
+#define EXT4_IOC_CREATE_TRACKER		_IO('f', 107)
+#define EXT4_IOC_FLIP_INODE_BIT		_IOW('f', 108, __u64)
+#define EXT4_IOC_FLIP_INODE_BITS	_IOW('f', 109, struct ext4_evfs_batch)
+#define EXT4_IOC_SUBMIT_BLOCK_BITS	_IOWR('f', 110, struct ext4_evfs_async)
+#define EXT4_IOC_WAIT_TICKET		_IOWR('f', 111, struct ext4_evfs_wait)
+#define EXT4_IOC_OPEN_SESSION		_IO('f', 112)
+#define EXT4_IOC_SESSION_COMMIT		_IOWR('f', 113, struct ext4_evfs_commit)
+#define EXT4_IOC_SESSION_ABORT		_IO('f', 114)	/* on the session fd */
+#define EXT4_IOC_OPEN_CMD_FD		_IO('f', 115)
+#define EXT4_IOC_OPEN_SUBMITTER		_IO('f', 116)
+
+long __ext4_evfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+#endif	/* _EXT4_EVFS_H */
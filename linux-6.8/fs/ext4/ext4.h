@@ -1488,6 +1488,8 @@ struct ext4_orphan_info {
 						 * file blocks */
 };
 
+struct ext4_evfs_info;
+
 /*
  * fourth extended-fs super-block data in memory
  */
@@ -1755,6 +1757,9 @@ struct ext4_sb_info {
 	int s_fc_debug_max_replay;
 #endif
 	struct ext4_fc_replay_state s_fc_replay_state;
+
+	/* EVFS state while anything uses it (see ext4-evfs.c) */
+	struct ext4_evfs_info __rcu *s_evfs_info;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
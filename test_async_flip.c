@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_async {
+    uint64_t ea_blocks;
+    uint32_t ea_count;
+    uint32_t ea_flags;
+    int32_t ea_eventfd;
+    uint32_t ea_pad;
+    uint64_t ea_ticket;
+};
+struct ext4_evfs_wait {
+    uint64_t ew_ticket;
+    uint64_t ew_tid;
+    int32_t ew_result;
+    uint32_t ew_flags;
+};
+#define EXT4_EVFS_BATCH_CLEAR 0x0002
+#define EXT4_EVFS_WAIT_NOWAIT 0x0001
+#define EXT4_IOC_SUBMIT_BLOCK_BITS _IOWR('f', 110, struct ext4_evfs_async)
+#define EXT4_IOC_WAIT_TICKET       _IOWR('f', 111, struct ext4_evfs_wait)
+#define EXT4_IOC_OPEN_SUBMITTER    _IO('f', 116)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Submit count single-block flips of [start, start + count) one at a
+ * time, wait for the eventfd to have counted them all, then collect
+ * every ticket. Returns the number of distinct transactions they used.
+ */
+static int flip_async(int fd, int efd, uint64_t start, unsigned count,
+                      uint64_t *tickets) {
+    double t0 = now();
+    for (unsigned i = 0; i < count; i++) {
+        uint64_t block = start + i;
+        struct ext4_evfs_async ea = {
+            .ea_blocks = (uintptr_t)&block,
+            .ea_count = 1,
+            .ea_eventfd = efd,
+        };
+        if (ioctl(fd, EXT4_IOC_SUBMIT_BLOCK_BITS, &ea) < 0) {
+            perror("ioctl SUBMIT_BLOCK_BITS");
+            return -1;
+        }
+        tickets[i] = ea.ea_ticket;
+    }
+    double t1 = now();
+
+    uint64_t done = 0, n;
+    while (done < count) {
+        if (read(efd, &n, sizeof(n)) != sizeof(n)) {
+            perror("read eventfd");
+            return -1;
+        }
+        done += n;
+    }
+    double t2 = now();
+
+    int tids = 0;
+    uint64_t last_tid = 0;
+    for (unsigned i = 0; i < count; i++) {
+        struct ext4_evfs_wait ew = {
+            .ew_ticket = tickets[i],
+            .ew_flags = EXT4_EVFS_WAIT_NOWAIT,
+        };
+        // the eventfd said they're all done, so none should be pending
+        if (ioctl(fd, EXT4_IOC_WAIT_TICKET, &ew) < 0) {
+            perror("ioctl WAIT_TICKET");
+            return -1;
+        }
+        if (ew.ew_result < 0) {
+            printf("block %lu: %s\n", start + i, strerror(-ew.ew_result));
+            return -1;
+        }
+        if (i == 0 || ew.ew_tid != last_tid)
+            tids++;
+        last_tid = ew.ew_tid;
+    }
+    printf("submitted %u in %.3fms, all done after %.3fms, %d transaction(s)\n",
+           count, (t1 - t0) * 1e3, (t2 - t0) * 1e3, tids);
+    return tids;
+}
+
+/*
+ * usage: test_async_flip [start] [count]
+ * Flips blocks [start, start + count) through asynchronous submission
+ * and then flips them back the same way. The range should be free.
+ */
+int main(int argc, char **argv) {
+    uint64_t start = argc > 1 ? strtoull(argv[1], NULL, 0) : 40000;
+    unsigned count = argc > 2 ? atoi(argv[2]) : 1024;
+
+    int file = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (file < 0) { perror("open"); return 1; }
+    int fd = ioctl(file, EXT4_IOC_OPEN_SUBMITTER);
+    if (fd < 0) { perror("ioctl OPEN_SUBMITTER"); return 1; }
+    int efd = eventfd(0, 0);
+    if (efd < 0) { perror("eventfd"); return 1; }
+
+    uint64_t *tickets = malloc(count * sizeof(*tickets));
+    if (!tickets) { perror("malloc"); return 1; }
+
+    if (flip_async(fd, efd, start, count, tickets) < 0 ||
+        flip_async(fd, efd, start, count, tickets) < 0)
+        return 1;
+
+    // a collected ticket is gone
+    struct ext4_evfs_wait ew = { .ew_ticket = tickets[0] };
+    if (ioctl(fd, EXT4_IOC_WAIT_TICKET, &ew) == 0 || errno != ENOENT) {
+        printf("ticket %lu could be collected twice\n", tickets[0]);
+        return 1;
+    }
+
+    // tickets belong to the fd they were submitted through
+    int other = ioctl(file, EXT4_IOC_OPEN_SUBMITTER);
+    if (other < 0) { perror("ioctl OPEN_SUBMITTER"); return 1; }
+    // clearing a block of the (free) range changes nothing either way
+    uint64_t block = start;
+    struct ext4_evfs_async ea = {
+        .ea_blocks = (uintptr_t)&block,
+        .ea_count = 1,
+        .ea_flags = EXT4_EVFS_BATCH_CLEAR,
+        .ea_eventfd = -1,
+    };
+    if (ioctl(fd, EXT4_IOC_SUBMIT_BLOCK_BITS, &ea) < 0) {
+        perror("ioctl SUBMIT_BLOCK_BITS");
+        return 1;
+    }
+    ew = (struct ext4_evfs_wait){ .ew_ticket = ea.ea_ticket };
+    if (ioctl(other, EXT4_IOC_WAIT_TICKET, &ew) == 0 || errno != ENOENT) {
+        printf("ticket %lu could be collected through another fd\n",
+               ea.ea_ticket);
+        return 1;
+    }
+    close(other);
+
+    // closing the fd with the ticket uncollected drops it
+    close(efd);
+    close(fd);
+    close(file);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define EXT4_IOC_FLIP_BLOCK_BIT _IOW('f', 100, uint64_t)
+
+struct ext4_evfs_batch {
+    uint64_t eb_blocks;
+    uint64_t eb_status;
+    uint64_t eb_prior;
+    uint32_t eb_count;
+    uint32_t eb_flags;
+};
+#define EXT4_IOC_FLIP_BLOCK_BITS _IOW('f', 101, struct ext4_evfs_batch)
+
+#define FIRST_BLOCK 1000
+#define NR_BLOCKS   4096
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Flip NR_BLOCKS blocks twice (so the image ends where it started): once
+ * with one ioctl per block, once with a single batched ioctl.
+ */
+int main(void) {
+    int fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+
+    uint64_t *blocks = malloc(NR_BLOCKS * sizeof(*blocks));
+    int32_t *status = malloc(NR_BLOCKS * sizeof(*status));
+    if (!blocks || !status) { perror("malloc"); return 1; }
+    for (int i = 0; i < NR_BLOCKS; i++)
+        blocks[i] = FIRST_BLOCK + i;
+
+    double t0 = now();
+    for (int i = 0; i < NR_BLOCKS; i++) {
+        if (ioctl(fd, EXT4_IOC_FLIP_BLOCK_BIT, &blocks[i]) < 0) {
+            perror("ioctl FLIP_BLOCK_BIT");
+            return 1;
+        }
+    }
+    double single = now() - t0;
+
+    struct ext4_evfs_batch batch = {
+        .eb_blocks = (uintptr_t)blocks,
+        .eb_status = (uintptr_t)status,
+        .eb_count = NR_BLOCKS,
+    };
+    t0 = now();
+    if (ioctl(fd, EXT4_IOC_FLIP_BLOCK_BITS, &batch) < 0) {
+        perror("ioctl FLIP_BLOCK_BITS");
+        return 1;
+    }
+    double batched = now() - t0;
+
+    for (int i = 0; i < NR_BLOCKS; i++) {
+        if (status[i] < 0) {
+            printf("block %lu: error %d\n", blocks[i], status[i]);
+            return 1;
+        }
+    }
+
+    printf("single:  %d flips in %.3fs (%.0f flips/s)\n",
+           NR_BLOCKS, single, NR_BLOCKS / single);
+    printf("batched: %d flips in %.3fs (%.0f flips/s)\n",
+           NR_BLOCKS, batched, NR_BLOCKS / batched);
+
+    close(fd);
+    return 0;
+}
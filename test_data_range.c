@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_range {
+    uint64_t er_start;
+    uint64_t er_len;
+    uint64_t er_changed;
+    uint64_t er_prior;
+    uint32_t er_flags;
+    uint32_t er_pad;
+};
+#define EXT4_IOC_SET_BLOCK_RANGE   _IOWR('f', 102, struct ext4_evfs_range)
+#define EXT4_IOC_CLEAR_BLOCK_RANGE _IOWR('f', 103, struct ext4_evfs_range)
+
+#define START 32000
+#define LEN   1536
+
+static int count_set(const uint8_t *bits, int n) {
+    int set = 0;
+    for (int i = 0; i < n; i++)
+        set += (bits[i / 8] >> (i % 8)) & 1;
+    return set;
+}
+
+/*
+ * Set a run that crosses a group boundary, then clear it again. The
+ * prior-state bitmap from the set shows what was allocated beforehand,
+ * so the clear is only issued when the run started out free.
+ */
+int main(void) {
+    int fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+
+    uint8_t prior[LEN / 8];
+    struct ext4_evfs_range range = {
+        .er_start = START,
+        .er_len = LEN,
+        .er_prior = (uintptr_t)prior,
+    };
+    if (ioctl(fd, EXT4_IOC_SET_BLOCK_RANGE, &range) < 0) {
+        perror("ioctl SET_BLOCK_RANGE");
+        return 1;
+    }
+    printf("set [%d, %d): %lu bits changed, %d were already set\n",
+           START, START + LEN, range.er_changed, count_set(prior, LEN));
+    if (count_set(prior, LEN)) {
+        printf("run was not free beforehand, leaving it set\n");
+        return 0;
+    }
+
+    range.er_prior = 0;
+    if (ioctl(fd, EXT4_IOC_CLEAR_BLOCK_RANGE, &range) < 0) {
+        perror("ioctl CLEAR_BLOCK_RANGE");
+        return 1;
+    }
+    printf("cleared [%d, %d): %lu bits changed\n", START, START + LEN,
+           range.er_changed);
+
+    close(fd);
+    return 0;
+}
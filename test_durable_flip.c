@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_batch {
+    uint64_t eb_blocks;
+    uint64_t eb_status;
+    uint64_t eb_prior;
+    uint32_t eb_count;
+    uint32_t eb_flags;
+};
+#define EXT4_EVFS_BATCH_COMMIT 0x0008
+#define EXT4_EVFS_BATCH_SYNC   0x0010
+#define EXT4_IOC_FLIP_BLOCK_BITS _IOW('f', 101, struct ext4_evfs_batch)
+
+#define MAX_THREADS 64
+
+static int fd;
+static long iters;
+static uint32_t flags;
+static uint64_t first_block;
+static pthread_barrier_t start_line;
+
+/* Flip this thread's block an even number of times, durably each time */
+static void *flipper(void *arg) {
+    uint64_t block = first_block + (uintptr_t)arg;
+    int32_t status;
+    struct ext4_evfs_batch batch = {
+        .eb_blocks = (uintptr_t)&block,
+        .eb_status = (uintptr_t)&status,
+        .eb_count = 1,
+        .eb_flags = flags,
+    };
+
+    pthread_barrier_wait(&start_line);
+    for (long i = 0; i < iters; i++) {
+        if (ioctl(fd, EXT4_IOC_FLIP_BLOCK_BITS, &batch) < 0 || status < 0) {
+            perror("ioctl FLIP_BLOCK_BITS");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static double run(int nthreads) {
+    pthread_t tids[MAX_THREADS];
+    struct timespec t0, t1;
+
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, flipper, (void *)(uintptr_t)t);
+    pthread_barrier_wait(&start_line);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&start_line);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * usage: test_durable_flip [commit|sync|none] [max_threads] [start] [iters]
+ * Thread t flips block start + t, waiting for each flip to be durable.
+ * Threads whose flips land in the same transaction share its commit, so
+ * the rate should grow with the thread count rather than stay at one
+ * commit per flip. Blocks [start, start + max_threads) should be free.
+ */
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "commit";
+    int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+    first_block = argc > 3 ? strtoull(argv[3], NULL, 0) : 40000;
+    iters = argc > 4 ? atol(argv[4]) : 200;
+    iters += iters & 1;
+
+    if (!strcmp(mode, "commit"))
+        flags = EXT4_EVFS_BATCH_COMMIT;
+    else if (!strcmp(mode, "sync"))
+        flags = EXT4_EVFS_BATCH_SYNC;
+    else if (strcmp(mode, "none")) {
+        fprintf(stderr, "mode must be commit, sync or none\n");
+        return 1;
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+        fprintf(stderr, "max_threads must be 1..%d\n", MAX_THREADS);
+        return 1;
+    }
+    fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+
+    printf("threads  flips/s\n");
+    for (int n = 1; n <= max_threads; n *= 2)
+        printf("%7d  %7.0f\n", n, n * iters / run(n));
+
+    close(fd);
+    return 0;
+}
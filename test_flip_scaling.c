@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_query {
+    uint64_t eq_start;
+    uint64_t eq_len;
+    uint64_t eq_bits;
+    uint32_t eq_flags;
+    uint32_t eq_pad;
+};
+#define EXT4_IOC_FLIP_BLOCK_BIT _IOW('f', 100, uint64_t)
+#define EXT4_IOC_GET_BLOCK_BITS _IOW('f', 104, struct ext4_evfs_query)
+
+#define MAX_THREADS 64
+
+static int fd;
+static long iters;
+static uint64_t blocks[MAX_THREADS];
+static pthread_barrier_t start_line;
+
+/* First free block in the middle half of group g, or 0 if there is none */
+static uint64_t free_block_in_group(uint64_t g, uint64_t per_group) {
+    uint64_t start = g * per_group + per_group / 4, len = per_group / 2;
+    uint8_t *bits = malloc(len / 8);
+    struct ext4_evfs_query query = {
+        .eq_start = start,
+        .eq_len = len,
+        .eq_bits = (uintptr_t)bits,
+    };
+    uint64_t found = 0;
+
+    if (bits && ioctl(fd, EXT4_IOC_GET_BLOCK_BITS, &query) == 0) {
+        for (uint64_t i = 0; i < len; i++) {
+            if (!(bits[i / 8] & (1 << (i % 8)))) {
+                found = start + i;
+                break;
+            }
+        }
+    }
+    free(bits);
+    return found;
+}
+
+/* Flip this thread's block an even number of times, leaving it as found */
+static void *flipper(void *arg) {
+    uint64_t block = blocks[(uintptr_t)arg];
+
+    pthread_barrier_wait(&start_line);
+    for (long i = 0; i < iters; i++) {
+        if (ioctl(fd, EXT4_IOC_FLIP_BLOCK_BIT, &block) < 0) {
+            perror("ioctl FLIP_BLOCK_BIT");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static double run(int nthreads) {
+    pthread_t tids[MAX_THREADS];
+    struct timespec t0, t1;
+
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, flipper, (void *)(uintptr_t)t);
+    pthread_barrier_wait(&start_line);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&start_line);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * usage: test_flip_scaling [max_threads] [blocks_per_group] [iters]
+ * Thread t flips a free block of group t, so no two threads share a
+ * group lock. Runs with 1..max_threads threads and prints the throughput
+ * and the speedup over one thread, which should grow close to linearly
+ * while there are cores to spare.
+ */
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    uint64_t per_group = argc > 2 ? strtoull(argv[2], NULL, 0) : 32768;
+    iters = argc > 3 ? atol(argv[3]) : 100000;
+    iters += iters & 1;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+        fprintf(stderr, "max_threads must be 1..%d\n", MAX_THREADS);
+        return 1;
+    }
+    fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+
+    for (int t = 0; t < max_threads; t++) {
+        blocks[t] = free_block_in_group(t, per_group);
+        if (!blocks[t]) {
+            fprintf(stderr, "no free block found in group %d\n", t);
+            return 1;
+        }
+    }
+
+    double base = 0;
+    printf("threads  flips/s      speedup\n");
+    for (int n = 1; n <= max_threads; n++) {
+        double secs = run(n);
+        double rate = n * iters / secs;
+
+        if (n == 1)
+            base = rate;
+        printf("%7d  %11.0f  %7.2f\n", n, rate, rate / base);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_query {
+    uint64_t eq_start;
+    uint64_t eq_len;
+    uint64_t eq_bits;
+    uint32_t eq_flags;
+    uint32_t eq_pad;
+};
+#define EXT4_IOC_GET_BLOCK_BITS _IOW('f', 104, struct ext4_evfs_query)
+
+/*
+ * usage: test_get_bits [start] [len]
+ * Prints the block's state for a single block (like debugfs testb),
+ * otherwise how many of the len blocks are in use and how long it took.
+ */
+int main(int argc, char **argv) {
+    uint64_t start = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000;
+    uint64_t len = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+
+    int fd = open("/home/evie/code/evfs-sandbox", O_RDONLY);
+    if (fd < 0) { perror("open"); return 1; }
+
+    uint8_t *bits = malloc((len + 7) / 8);
+    if (!bits) { perror("malloc"); return 1; }
+
+    struct ext4_evfs_query query = {
+        .eq_start = start,
+        .eq_len = len,
+        .eq_bits = (uintptr_t)bits,
+    };
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (ioctl(fd, EXT4_IOC_GET_BLOCK_BITS, &query) < 0) {
+        perror("ioctl GET_BLOCK_BITS");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (len == 1) {
+        printf("Block %lu %s\n", start,
+               (bits[0] & 1) ? "marked in use" : "not in use");
+    } else {
+        uint64_t used = 0;
+        for (uint64_t i = 0; i < len; i++)
+            used += (bits[i / 8] >> (i % 8)) & 1;
+        printf("%lu of %lu blocks from %lu in use (%.3f ms)\n", used, len,
+               start, (t1.tv_sec - t0.tv_sec) * 1e3 +
+               (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+
+struct ext4_evfs_batch {
+    uint64_t eb_blocks;
+    uint64_t eb_status;
+    uint64_t eb_prior;
+    uint32_t eb_count;
+    uint32_t eb_flags;
+};
+#define EXT4_EVFS_BATCH_SET   0x0001
+#define EXT4_EVFS_BATCH_CLEAR 0x0002
+#define EXT4_EVFS_BATCH_DIR   0x0004
+#define EXT4_IOC_FLIP_INODE_BITS _IOW('f', 109, struct ext4_evfs_batch)
+
+#define SANDBOX "/home/evie/code/evfs-sandbox"
+
+static uint64_t free_inodes(void) {
+    struct statfs st;
+    if (statfs(SANDBOX, &st) < 0) { perror("statfs"); exit(1); }
+    return st.f_ffree;
+}
+
+static int inode_op(int fd, uint64_t *inos, int32_t *status, unsigned n,
+                    uint32_t flags) {
+    struct ext4_evfs_batch batch = {
+        .eb_blocks = (uintptr_t)inos,
+        .eb_status = (uintptr_t)status,
+        .eb_count = n,
+        .eb_flags = flags,
+    };
+    if (ioctl(fd, EXT4_IOC_FLIP_INODE_BITS, &batch) < 0) {
+        perror("ioctl FLIP_INODE_BITS");
+        return -1;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if (status[i] < 0) {
+            printf("inode %lu: %s\n", inos[i], strerror(-status[i]));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * usage: test_inode_bits [first_ino] [count]
+ * Claims count inodes from first_ino on as directories, checks the free
+ * inode count dropped by count, releases them and checks it's back.
+ * The inodes should be free; pick them from the end of the filesystem.
+ */
+int main(int argc, char **argv) {
+    uint64_t first = argc > 1 ? strtoull(argv[1], NULL, 0) : 60000;
+    unsigned count = argc > 2 ? atoi(argv[2]) : 64;
+
+    int fd = open(SANDBOX, O_RDONLY);
+    if (fd < 0) { perror("open"); return 1; }
+
+    uint64_t *inos = malloc(count * sizeof(*inos));
+    int32_t *status = malloc(count * sizeof(*status));
+    if (!inos || !status) { perror("malloc"); return 1; }
+    for (unsigned i = 0; i < count; i++)
+        inos[i] = first + i;
+
+    uint64_t before = free_inodes();
+    if (inode_op(fd, inos, status, count,
+                 EXT4_EVFS_BATCH_SET | EXT4_EVFS_BATCH_DIR))
+        return 1;
+    uint64_t claimed = free_inodes();
+    printf("claimed %u inodes: free %lu -> %lu\n", count, before, claimed);
+    if (before - claimed != count) {
+        printf("free inode count is off by %ld\n",
+               (long)(before - claimed) - (long)count);
+        return 1;
+    }
+
+    if (inode_op(fd, inos, status, count, EXT4_EVFS_BATCH_CLEAR))
+        return 1;
+    uint64_t after = free_inodes();
+    printf("released them: free %lu\n", after);
+    if (after != before) {
+        printf("free inode count did not come back\n");
+        return 1;
+    }
+
+    close(fd);
+    return 0;
+}
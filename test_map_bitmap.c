@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define EXT4_EVFS_MAP_MAGIC 0x45564653
+
+struct ext4_evfs_map_header {
+    uint32_t mh_magic;
+    uint32_t mh_groups;
+    uint32_t mh_bits_per_group;
+    uint32_t mh_bitmap_offset;
+    uint64_t mh_size;
+    uint64_t mh_first_block;
+    uint64_t mh_blocks;
+    uint32_t mh_seq[];
+};
+#define EXT4_IOC_MAP_BLOCK_BITMAP _IO('f', 105)
+#define EXT4_IOC_MAP_SYNC         _IO('f', 106)
+
+/* Count free blocks of one group, retrying while the kernel rewrites it */
+static uint64_t group_free(const struct ext4_evfs_map_header *hdr,
+                           const uint8_t *bitmap, uint32_t group) {
+    uint32_t bytes = hdr->mh_bits_per_group / 8;
+    uint32_t seq;
+    uint64_t free;
+
+    do {
+        while ((seq = __atomic_load_n(&hdr->mh_seq[group], __ATOMIC_ACQUIRE)) & 1)
+            ;
+        free = 0;
+        for (uint32_t i = 0; i < bytes; i++)
+            free += 8 - __builtin_popcount(bitmap[(uint64_t)group * bytes + i]);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&hdr->mh_seq[group], __ATOMIC_RELAXED) != seq);
+    return free;
+}
+
+int main(void) {
+    int fd = open("/home/evie/code/evfs-sandbox", O_RDONLY);
+    if (fd < 0) { perror("open"); return 1; }
+
+    int mapfd = ioctl(fd, EXT4_IOC_MAP_BLOCK_BITMAP);
+    if (mapfd < 0) { perror("ioctl MAP_BLOCK_BITMAP"); return 1; }
+
+    struct ext4_evfs_map_header *hdr =
+        mmap(NULL, sizeof(*hdr), PROT_READ, MAP_SHARED, mapfd, 0);
+    if (hdr == MAP_FAILED) { perror("mmap header"); return 1; }
+    if (hdr->mh_magic != EXT4_EVFS_MAP_MAGIC) {
+        printf("bad magic %#x\n", hdr->mh_magic);
+        return 1;
+    }
+    size_t size = hdr->mh_size;
+    munmap(hdr, sizeof(*hdr));
+
+    hdr = mmap(NULL, size, PROT_READ, MAP_SHARED, mapfd, 0);
+    if (hdr == MAP_FAILED) { perror("mmap"); return 1; }
+    const uint8_t *bitmap = (const uint8_t *)hdr + hdr->mh_bitmap_offset;
+
+    /* pick up anything the allocator did since the map was created */
+    if (ioctl(mapfd, EXT4_IOC_MAP_SYNC) < 0) { perror("ioctl MAP_SYNC"); return 1; }
+
+    uint64_t free = 0;
+    for (uint32_t g = 0; g < hdr->mh_groups; g++)
+        free += group_free(hdr, bitmap, g);
+    printf("%u groups, %lu blocks, %lu free\n", hdr->mh_groups,
+           hdr->mh_blocks, free);
+
+    munmap(hdr, size);
+    close(mapfd);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_batch {
+    uint64_t eb_blocks;
+    uint64_t eb_status;
+    uint64_t eb_prior;
+    uint32_t eb_count;
+    uint32_t eb_flags;
+};
+struct ext4_evfs_range {
+    uint64_t er_start;
+    uint64_t er_len;
+    uint64_t er_changed;
+    uint64_t er_prior;
+    uint32_t er_flags;
+    uint32_t er_pad;
+};
+struct ext4_evfs_query {
+    uint64_t eq_start;
+    uint64_t eq_len;
+    uint64_t eq_bits;
+    uint32_t eq_flags;
+    uint32_t eq_pad;
+};
+struct ext4_evfs_commit {
+    uint64_t ec_changed;
+    uint32_t ec_flags;
+    uint32_t ec_pad;
+};
+#define EXT4_EVFS_BATCH_CLEAR      0x0002
+#define EXT4_EVFS_BATCH_COMMIT     0x0008
+#define EXT4_IOC_FLIP_BLOCK_BITS   _IOW('f', 101, struct ext4_evfs_batch)
+#define EXT4_IOC_SET_BLOCK_RANGE   _IOWR('f', 102, struct ext4_evfs_range)
+#define EXT4_IOC_CLEAR_BLOCK_RANGE _IOWR('f', 103, struct ext4_evfs_range)
+#define EXT4_IOC_GET_BLOCK_BITS    _IOW('f', 104, struct ext4_evfs_query)
+#define EXT4_IOC_OPEN_SESSION      _IO('f', 112)
+#define EXT4_IOC_SESSION_COMMIT    _IOWR('f', 113, struct ext4_evfs_commit)
+#define EXT4_IOC_SESSION_ABORT     _IO('f', 114)
+
+#define START 36000
+#define LEN   1536
+/* in use from mkfs, so EVFS may not clear it */
+#define UNCLAIMED 1
+
+static int fd;
+
+/* How many of [START, START + LEN] are set */
+static int count_set(void) {
+    uint8_t bits[LEN / 8 + 1];
+    struct ext4_evfs_query query = {
+        .eq_start = START,
+        .eq_len = LEN + 1,
+        .eq_bits = (uintptr_t)bits,
+    };
+    int set = 0;
+
+    if (ioctl(fd, EXT4_IOC_GET_BLOCK_BITS, &query) < 0) {
+        perror("ioctl GET_BLOCK_BITS");
+        return -1;
+    }
+    for (int i = 0; i <= LEN; i++)
+        set += (bits[i / 8] >> (i % 8)) & 1;
+    return set;
+}
+
+/* Queue a set or clear of [START, START + LEN) and a flip of START + LEN */
+static int queue(int sfd, unsigned long range_cmd) {
+    uint64_t block = START + LEN;
+    struct ext4_evfs_range range = { .er_start = START, .er_len = LEN };
+    struct ext4_evfs_batch batch = {
+        .eb_blocks = (uintptr_t)&block,
+        .eb_count = 1,
+    };
+
+    if (ioctl(sfd, range_cmd, &range) < 0) {
+        perror("ioctl queue range");
+        return -1;
+    }
+    if (ioctl(sfd, EXT4_IOC_FLIP_BLOCK_BITS, &batch) < 0) {
+        perror("ioctl queue flip");
+        return -1;
+    }
+    return 0;
+}
+
+static int expect(const char *what, int want) {
+    int set = count_set();
+
+    printf("%s: %d of %d set\n", what, set, LEN + 1);
+    if (set != want) {
+        printf("expected %d\n", want);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * usage: test_session
+ * Sets [START, START + LEN] in one session and checks a second session,
+ * whose last op clears a block EVFS didn't claim, changes nothing when
+ * committed; then aborts a session and finally commits one that clears
+ * the range again. The range should be free to begin with.
+ */
+int main(void) {
+    fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+    if (expect("before", 0) < 0)
+        return 1;
+
+    int sfd = ioctl(fd, EXT4_IOC_OPEN_SESSION);
+    if (sfd < 0) { perror("ioctl OPEN_SESSION"); return 1; }
+    struct ext4_evfs_commit ec = { .ec_flags = EXT4_EVFS_BATCH_COMMIT };
+    if (queue(sfd, EXT4_IOC_SET_BLOCK_RANGE) < 0)
+        return 1;
+    if (ioctl(sfd, EXT4_IOC_SESSION_COMMIT, &ec) < 0) {
+        perror("ioctl SESSION_COMMIT");
+        return 1;
+    }
+    printf("committed set: %lu bits changed\n", ec.ec_changed);
+    if (expect("after set", LEN + 1) < 0)
+        return 1;
+
+    // the failing clear comes last, but is caught before anything changes
+    uint64_t unclaimed = UNCLAIMED;
+    struct ext4_evfs_batch bad = {
+        .eb_blocks = (uintptr_t)&unclaimed,
+        .eb_count = 1,
+        .eb_flags = EXT4_EVFS_BATCH_CLEAR,
+    };
+    if (queue(sfd, EXT4_IOC_CLEAR_BLOCK_RANGE) < 0)
+        return 1;
+    if (ioctl(sfd, EXT4_IOC_FLIP_BLOCK_BITS, &bad) < 0) {
+        perror("ioctl queue clear");
+        return 1;
+    }
+    if (ioctl(sfd, EXT4_IOC_SESSION_COMMIT, &ec) == 0 || errno != EPERM) {
+        printf("commit clearing block %d didn't fail with EPERM\n",
+               UNCLAIMED);
+        return 1;
+    }
+    if (expect("after failed commit", LEN + 1) < 0)
+        return 1;
+
+    if (queue(sfd, EXT4_IOC_CLEAR_BLOCK_RANGE) < 0)
+        return 1;
+    if (ioctl(sfd, EXT4_IOC_SESSION_ABORT) < 0) {
+        perror("ioctl SESSION_ABORT");
+        return 1;
+    }
+    if (expect("after abort", LEN + 1) < 0)
+        return 1;
+
+    if (queue(sfd, EXT4_IOC_CLEAR_BLOCK_RANGE) < 0)
+        return 1;
+    if (ioctl(sfd, EXT4_IOC_SESSION_COMMIT, &ec) < 0) {
+        perror("ioctl SESSION_COMMIT");
+        return 1;
+    }
+    printf("committed clear: %lu bits changed\n", ec.ec_changed);
+    if (expect("after clear", 0) < 0)
+        return 1;
+
+    close(sfd);
+    close(fd);
+    return 0;
+}
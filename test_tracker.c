@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+struct ext4_evfs_range {
+    uint64_t er_start;
+    uint64_t er_len;
+    uint64_t er_changed;
+    uint64_t er_prior;
+    uint32_t er_flags;
+    uint32_t er_pad;
+};
+#define EXT4_IOC_SET_BLOCK_RANGE   _IOWR('f', 102, struct ext4_evfs_range)
+#define EXT4_IOC_CLEAR_BLOCK_RANGE _IOWR('f', 103, struct ext4_evfs_range)
+#define EXT4_IOC_CREATE_TRACKER    _IO('f', 107)
+
+#define START 40000
+#define LEN   1024
+
+static int range_op(int fd, unsigned long cmd, uint64_t start, uint64_t len) {
+    struct ext4_evfs_range range = { .er_start = start, .er_len = len };
+    return ioctl(fd, cmd, &range);
+}
+
+/*
+ * EVFS may only clear blocks it claimed itself. Claim a free run, give
+ * back its middle, check that the superblock's block (which EVFS never
+ * claimed) is refused, then give back the rest. Claims are kept in the
+ * on-disk tracker, which is created first if the filesystem has none.
+ */
+int main(void) {
+    int fd = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (fd < 0) { perror("open"); return 1; }
+
+    if (ioctl(fd, EXT4_IOC_CREATE_TRACKER) < 0 && errno != EEXIST) {
+        perror("ioctl CREATE_TRACKER");
+        return 1;
+    }
+
+    uint8_t prior[LEN / 8];
+    struct ext4_evfs_range range = {
+        .er_start = START,
+        .er_len = LEN,
+        .er_prior = (uintptr_t)prior,
+    };
+    if (ioctl(fd, EXT4_IOC_SET_BLOCK_RANGE, &range) < 0) {
+        perror("ioctl SET_BLOCK_RANGE");
+        return 1;
+    }
+    if (range.er_changed != LEN) {
+        printf("[%d, %d) was not free beforehand, pick another START\n",
+               START, START + LEN);
+        return 1;
+    }
+
+    if (range_op(fd, EXT4_IOC_CLEAR_BLOCK_RANGE, START + 256, 512) < 0) {
+        perror("clear middle of claimed run");
+        return 1;
+    }
+    printf("cleared claimed blocks [%d, %d)\n", START + 256, START + 768);
+
+    if (range_op(fd, EXT4_IOC_CLEAR_BLOCK_RANGE, 0, 1) == 0 || errno != EPERM) {
+        printf("clearing unclaimed block 0 was not refused with EPERM\n");
+        return 1;
+    }
+    printf("clearing unclaimed block 0 refused: EPERM\n");
+
+    if (range_op(fd, EXT4_IOC_CLEAR_BLOCK_RANGE, START, LEN) < 0) {
+        perror("clear rest of claimed run");
+        return 1;
+    }
+    printf("cleared the rest of [%d, %d)\n", START, START + LEN);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <liburing.h>
+
+#define EXT4_IOC_FLIP_BLOCK_BIT _IOW('f', 100, uint64_t)
+#define EXT4_IOC_OPEN_CMD_FD _IO('f', 115)
+
+static int flip_all(struct io_uring *ring, int fd, uint64_t *blocks,
+                    unsigned count, unsigned depth) {
+    unsigned submitted = 0, done = 0;
+
+    while (done < count) {
+        while (submitted < count && submitted - done < depth) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            if (!sqe)
+                break;
+            io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+            sqe->cmd_op = EXT4_IOC_FLIP_BLOCK_BIT;
+            sqe->addr = (uintptr_t)&blocks[submitted];
+            sqe->user_data = submitted;
+            submitted++;
+        }
+        int ret = io_uring_submit_and_wait(ring, 1);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+            return -1;
+        }
+
+        struct io_uring_cqe *cqe;
+        unsigned head, reaped = 0;
+        io_uring_for_each_cqe(ring, head, cqe) {
+            if (cqe->res < 0) {
+                fprintf(stderr, "flip of block %lu failed: %s\n",
+                        blocks[cqe->user_data], strerror(-cqe->res));
+                return -1;
+            }
+            reaped++;
+        }
+        io_uring_cq_advance(ring, reaped);
+        done += reaped;
+    }
+    return 0;
+}
+
+/*
+ * usage: test_uring_flip [start] [count] [depth]
+ * Flips blocks [start, start + count) through io_uring with up to depth
+ * flips in flight, then flips them all back the same way, and reports
+ * the rate. The range should be free, since EVFS won't clear blocks it
+ * didn't claim. Build with -luring.
+ */
+int main(int argc, char **argv) {
+    uint64_t start = argc > 1 ? strtoull(argv[1], NULL, 0) : 40000;
+    unsigned count = argc > 2 ? atoi(argv[2]) : 4096;
+    unsigned depth = argc > 3 ? atoi(argv[3]) : 256;
+
+    int file = open("/home/evie/code/evfs-sandbox/fileA", O_RDWR);
+    if (file < 0) { perror("open"); return 1; }
+    // SQEs go to the command fd, which runs them against the file
+    int fd = ioctl(file, EXT4_IOC_OPEN_CMD_FD);
+    if (fd < 0) { perror("ioctl(EXT4_IOC_OPEN_CMD_FD)"); return 1; }
+
+    // each in-flight flip reads its block number when it runs
+    uint64_t *blocks = malloc(count * sizeof(*blocks));
+    if (!blocks) { perror("malloc"); return 1; }
+    for (unsigned i = 0; i < count; i++)
+        blocks[i] = start + i;
+
+    struct io_uring ring;
+    int ret = io_uring_queue_init(depth, &ring, 0);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (flip_all(&ring, fd, blocks, count, depth) ||
+        flip_all(&ring, fd, blocks, count, depth))
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%u flips at depth %u in %.3fs (%.0f flips/s)\n",
+           2 * count, depth, secs, 2 * count / secs);
+
+    io_uring_queue_exit(&ring);
+    close(fd);
+    close(file);
+    return 0;
+}